@@ -1,19 +1,39 @@
 #include <iostream>
 
 #include "GameBoyConsole.hpp"
+#include "Hardware/PixelDecoder.hpp"
 
 #include "Utility/Utils.hpp"
 
 int main(const int argc, char* argv[])
 {
-    GameBoyConsole console;
-    
-    if (argc != 2) IncorrectUsage(argv[0]);
+    if (argc < 2 || argc > 3) IncorrectUsage(argv[0]);
 
     std::string filename = argv[1];
 
+    // Compares the vectorized tile decoder with the scalar one instead of running anything
+    if (filename == "-benchpixels")
+    {
+        PixelDecoder::Benchmark();
+        return 0;
+    }
+
+    GameBoyConsole console;
+
+    if (argc == 3)
+    {
+        // Plain execution, for comparing against idle-loop skipping
+        if (std::string(argv[2]) == "-noidleskip") console.SetIdleLoopSkipping(false);
+        else IncorrectUsage(argv[0]);
+    }
+
     console.InsertCartridge(filename);
 
+    while (console.Running())
+    {
+        console.RunFrame();
+    }
+
     system("pause");
     
     return 0;
@@ -1,12 +1,12 @@
 #include "GameBoyConsole.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 GameBoyConsole::GameBoyConsole()
+    : m_CPU(m_Bus, m_Scheduler), m_PPU(m_Bus, m_Scheduler), m_LCD(m_PPU), m_Timer(m_Bus, m_Scheduler), m_Serial(m_Bus, m_Scheduler),
+      m_DMA(m_Bus, m_Scheduler)
 {
-    m_Bus = std::make_shared<Bus>();
-    m_LCD = std::make_shared<LCD>(m_Bus);
-    m_CPU = std::make_shared<CPU>(m_Bus, m_LCD);
 }
 
 GameBoyConsole::~GameBoyConsole()
@@ -14,14 +14,49 @@ GameBoyConsole::~GameBoyConsole()
     EjectCartridge();
 }
 
-void GameBoyConsole::InsertCartridge(const std::string& cartridge) const
+void GameBoyConsole::InsertCartridge(const std::string& cartridge)
 {
-    m_Bus->InsertCartridge(cartridge);
-    m_CPU->Bootstrap();
-    m_CPU->Step(m_Bus->m_Cartridge->m_ROM.size() < 0x014F ? 0 : 0x100);
+    m_Bus.InsertCartridge(cartridge, m_Scheduler);
+    m_CPU.Bootstrap();
+    m_CPU.Register(CPU::Register16::PC, m_Bus.m_Cartridge->HasHeader() ? 0x100 : 0);
 }
 
 void GameBoyConsole::EjectCartridge()
 {
-    m_Cartridge.reset();
+    m_Bus.EjectCartridge();
+}
+
+U64 GameBoyConsole::RunCycles(U64 cycles)
+{
+    const U64 start = m_Scheduler.Now();
+
+    // Run frame by frame so that every completed frame gets presented
+    while (m_CPU.Running() && m_Scheduler.Now() - start < cycles)
+    {
+        const U64 remaining = cycles - (m_Scheduler.Now() - start);
+        m_CPU.Run(std::min(remaining, CyclesToFrame()));
+        PresentFrame();
+    }
+
+    return m_Scheduler.Now() - start;
+}
+
+U64 GameBoyConsole::RunFrame()
+{
+    return RunCycles(CyclesToFrame());
+}
+
+U64 GameBoyConsole::CyclesToFrame() const
+{
+    const U64 now = m_Scheduler.Now();
+    const U64 next = m_PPU.NextFrame();
+    return next > now ? std::min<U64>(next - now, PPU::FRAME_CYCLES) : PPU::FRAME_CYCLES;
+}
+
+void GameBoyConsole::PresentFrame()
+{
+    if (m_PPU.FrameCount() == m_PresentedFrame) return;
+
+    m_PresentedFrame = m_PPU.FrameCount();
+    m_LCD.Present();
 }
\ No newline at end of file
@@ -1,11 +1,15 @@
 #pragma once
-#include <memory>
 #include <string>
 
 #include "Hardware/Bus.hpp"
 #include "Hardware/Cartridge.hpp"
 #include "Hardware/CPU.hpp"
+#include "Hardware/DMA.hpp"
 #include "Hardware/LCD.hpp"
+#include "Hardware/PPU.hpp"
+#include "Hardware/Scheduler.hpp"
+#include "Hardware/Serial.hpp"
+#include "Hardware/Timer.hpp"
 #include "Utility/Utils.hpp"
 #include "Utility/Types.hpp"
 
@@ -14,12 +18,6 @@ class GameBoyConsole
 private: // Specifications
     constexpr static double CPU_FREQUENCY = 4'194'304.0;
 
-    constexpr static Size RESOLUTION_X = 160;
-    constexpr static Size RESOLUTION_Y = 144;
-
-    constexpr static Size MAX_SPRITES = 40;
-    constexpr static Size MAX_SPRITES_PER_LINE = 10;
-
 public:
     GameBoyConsole();
     ~GameBoyConsole();
@@ -29,12 +27,50 @@ public:
     GameBoyConsole(GameBoyConsole&&) = delete;
     GameBoyConsole& operator=(GameBoyConsole&&) = delete;    
     
-    void InsertCartridge(const std::string& cartridge) const;
+    void InsertCartridge(const std::string& cartridge);
     void EjectCartridge();
 
+    // Host-driven execution. Each call returns the T-cycles actually run (the last instruction may
+    // overshoot) and presents every frame completed along the way.
+    U64 RunCycles(U64 cycles);
+    U64 RunFrame();
+    template <class Predicate> U64 RunUntil(Predicate predicate);
+
+    bool Running() const { return m_CPU.Running(); }
+    void SetIdleLoopSkipping(bool enabled) { m_CPU.SetIdleLoopSkipping(enabled); }
+
+private:
+    // T-cycles until the PPU finishes its next frame, at most one frame's worth while the LCD is off
+    U64 CyclesToFrame() const;
+    void PresentFrame();
+
 private:
-    std::shared_ptr<Bus> m_Bus;
-    std::shared_ptr<CPU> m_CPU;
-    std::shared_ptr<LCD> m_LCD;
-    std::shared_ptr<Cartridge> m_Cartridge;
+    // Declared first so it outlives every component holding a reference to it
+    Scheduler m_Scheduler;
+
+    // Components live exactly as long as the console and refer to each other by plain reference;
+    // declaration order is construction order
+    Bus m_Bus;
+    CPU m_CPU;
+    PPU m_PPU;
+    LCD m_LCD;
+    Timer m_Timer;
+    Serial m_Serial;
+    DMA m_DMA;
+
+    U64 m_PresentedFrame = 0;
 };
+
+template <class Predicate>
+U64 GameBoyConsole::RunUntil(Predicate predicate)
+{
+    const U64 start = m_Scheduler.Now();
+
+    while (m_CPU.Running() && !predicate())
+    {
+        m_CPU.Step();
+        PresentFrame();
+    }
+
+    return m_Scheduler.Now() - start;
+}
@@ -0,0 +1,112 @@
+#include "BlockCache.hpp"
+
+#include "Bus.hpp"
+
+BlockCache::BlockCache()
+{
+    m_Recent.fill(nullptr);
+    m_CodeBytes.fill(0);
+    m_Uncached.instructions.reserve(1);
+    m_Generation = 0;
+}
+
+BlockCache::Block& BlockCache::Lookup(Bus& bus, Address pc)
+{
+    // I/O and OAM reads can have side effects or change under us, so code there is never cached.
+    // Neither is anything outside HRAM during OAM DMA, which the CPU fetches as 0xFF then.
+    if (!IsCacheable(pc) || (bus.HighRAMOnly() && pc < 0xFF80))
+    {
+        // Rebuilt on every lookup, it never gets hot enough to be translated
+        m_Uncached.entries = 0;
+        m_Uncached.native = nullptr;
+        m_Uncached.start = pc;
+        m_Uncached.length = InstructionLength(bus.Read(pc));
+        m_Uncached.instructions.clear();
+
+        DecodedInstruction instruction{ pc, bus.Read(pc), {} };
+        for (Size i = 1; i < m_Uncached.length; i++)
+        {
+            instruction.operands[i - 1] = bus.Read(static_cast<Address>(pc + i));
+        }
+        m_Uncached.instructions.push_back(instruction);
+
+        return m_Uncached;
+    }
+
+    Block*& recent = m_Recent[pc % m_Recent.size()];
+    if (recent != nullptr && recent->start == pc) return *recent;
+
+    auto [it, inserted] = m_Blocks.try_emplace(pc | bus.CodeBank(pc) << 16);
+    if (inserted)
+    {
+        Decode(bus, pc, it->second);
+        MarkCodeBytes(it->second, 1);
+    }
+
+    recent = &it->second;
+    return it->second;
+}
+
+void BlockCache::Decode(Bus& bus, Address pc, Block& block) const
+{
+    block.start = pc;
+    block.length = 0;
+    block.instructions.clear();
+
+    // A block never runs into the next 16 KiB area, which may be banked differently
+    Address address = pc;
+    for (Size i = 0; i < MAX_BLOCK_INSTRUCTIONS && IsCacheable(address) && (address & 0xC000) == (pc & 0xC000); i++)
+    {
+        DecodedInstruction instruction{ address, bus.Read(address), {} };
+        const U8 length = InstructionLength(instruction.opcode);
+
+        for (U8 j = 1; j < length; j++)
+        {
+            instruction.operands[j - 1] = bus.Read(static_cast<Address>(address + j));
+        }
+
+        block.instructions.push_back(instruction);
+        block.length += length;
+        address = static_cast<Address>(address + length);
+
+        if (EndsBlock(instruction.opcode)) break;
+    }
+
+    block.idleLoop = IsIdleLoop(block);
+}
+
+void BlockCache::Clear()
+{
+    m_Blocks.clear();
+    m_CodeBytes.fill(0);
+    m_Recent.fill(nullptr);
+    m_Generation++;
+
+    if (m_OnClear) m_OnClear();
+}
+
+void BlockCache::InvalidateBlocks(Address address)
+{
+    // Any block covering the written byte starts at most MAX_BLOCK_LENGTH - 1 bytes before it
+    const S32 first = static_cast<S32>(address) - static_cast<S32>(MAX_BLOCK_LENGTH) + 1;
+
+    for (S32 start = address; start >= 0 && start >= first; start--)
+    {
+        const auto it = m_Blocks.find(static_cast<U32>(start));
+        if (it == m_Blocks.end() || start + it->second.length <= address) continue;
+
+        MarkCodeBytes(it->second, -1);
+        m_Blocks.erase(it);
+    }
+
+    m_Recent.fill(nullptr);
+    m_Generation++;
+}
+
+void BlockCache::MarkCodeBytes(const Block& block, S8 delta)
+{
+    for (Size i = 0; i < block.length; i++)
+    {
+        m_CodeBytes[static_cast<Address>(block.start + i)] += delta;
+    }
+}
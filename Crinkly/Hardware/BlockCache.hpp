@@ -0,0 +1,220 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "Utility/Types.hpp"
+
+class Bus;
+class CPU;
+
+// Decoded basic-block cache. A block is decoded once from the bus into a compact array of
+// instructions (opcode + immediate operands) and reused until one of its bytes is overwritten.
+class BlockCache
+{
+public:
+    static constexpr Size MAX_BLOCK_INSTRUCTIONS = 32;
+    static constexpr Size MAX_INSTRUCTION_LENGTH = 3;
+    static constexpr Size MAX_BLOCK_LENGTH = MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_LENGTH;
+
+    struct DecodedInstruction
+    {
+        Address address;
+        U8 opcode;
+        U8 operands[MAX_INSTRUCTION_LENGTH - 1];
+    };
+
+    // Runs a translated block for at most `budget` T-cycles, stopping before the first instruction
+    // that would not fit; a block that jumps back to its own start keeps looping. Returns the
+    // T-cycles taken.
+    using NativeBlock = U32 (*)(CPU* cpu, U32 budget);
+
+    struct Block
+    {
+        Address start;
+        Size length;
+        std::vector<DecodedInstruction> instructions;
+
+        // A loop onto itself whose body only changes registers, see IsIdleLoop
+        bool idleLoop = false;
+
+        // Recompiler bookkeeping: how often the block was entered, and its translation once it got
+        // hot with the most T-cycles its first instruction takes
+        U32 entries = 0;
+        NativeBlock native = nullptr;
+        U32 entryCycles = 0;
+    };
+
+public:
+    BlockCache();
+
+    Block& Lookup(Bus& bus, Address pc);
+
+    // Called by the bus on every RAM write; only writes that hit a cached instruction byte do any work
+    void Invalidate(Address address)
+    {
+        if (m_CodeBytes[address] != 0) InvalidateBlocks(address);
+    }
+
+    // Drops every block, for when memory was replaced wholesale
+    void Clear();
+
+    // Called after Clear, for whoever keeps state derived from the dropped blocks
+    void OnClear(std::function<void()> handler) { m_OnClear = std::move(handler); }
+
+    // Called by the bus after a bank switch. Blocks are keyed by bank and stay valid, only the
+    // PC-indexed shortcuts are dropped and holders of a Block re-look up.
+    void Remap()
+    {
+        m_Recent.fill(nullptr);
+        m_Generation++;
+    }
+
+    // Per address, how many cached blocks cover it; translated code checks it on its own writes
+    const U8* CodeBytes() const { return m_CodeBytes.data(); }
+
+    // Incremented whenever cached blocks are dropped, so holders of a Block reference can detect it
+    U32 Generation() const { return m_Generation; }
+
+    static constexpr U8 InstructionLength(U8 opcode);
+    static constexpr bool EndsBlock(U8 opcode);
+    static constexpr bool IsSideEffectFree(const DecodedInstruction& instruction);
+    static constexpr bool IsIdleLoop(const Block& block);
+
+private:
+    // Cartridge RAM is banked without the bank being part of the key, so it is treated like I/O
+    static constexpr bool IsCacheable(Address address)
+    {
+        return address < 0xA000 || (address >= 0xC000 && address < 0xFE00) || address >= 0xFF80;
+    }
+
+    void Decode(Bus& bus, Address pc, Block& block) const;
+    void InvalidateBlocks(Address address);
+    void MarkCodeBytes(const Block& block, S8 delta);
+
+private:
+    // Keyed by PC, with the ROM bank mapped there in the upper half
+    std::unordered_map<U32, Block> m_Blocks;
+    std::array<Block*, 64> m_Recent;
+    std::array<U8, 0x10000> m_CodeBytes;
+    Block m_Uncached;
+    U32 m_Generation;
+    std::function<void()> m_OnClear;
+};
+
+constexpr U8 BlockCache::InstructionLength(U8 opcode)
+{
+    switch (opcode)
+    {
+    case 0x01: case 0x11: case 0x21: case 0x31: // ld r16, imm16
+    case 0x08: // ld [imm16], sp
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // jp (cond), imm16
+    case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // call (cond), imm16
+    case 0xEA: case 0xFA: // ld [imm16], a / ld a, [imm16]
+        return 3;
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // ld r8, imm8
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr (cond), imm8
+    case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu a, imm8
+    case 0xE0: case 0xF0: // ldh
+    case 0xE8: case 0xF8: // add sp, imm8 / ld hl, sp + imm8
+    case 0xCB: // prefix
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+constexpr bool BlockCache::EndsBlock(U8 opcode)
+{
+    switch (opcode)
+    {
+    case 0x10: case 0x76: // stop, halt
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // jp
+    case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // call
+    case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: // ret, reti
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // rst
+        return true;
+    default:
+        return false;
+    }
+}
+
+// True for instructions that can only change registers and flags: no memory writes, no stack,
+// no IME/halt changes and no debug breakpoints
+constexpr bool BlockCache::IsSideEffectFree(const DecodedInstruction& instruction)
+{
+    const U8 opcode = instruction.opcode;
+
+    if (opcode == 0xCB)
+    {
+        // bit b, r8 and bit b, [hl] only read; everything else on [hl] writes back
+        const U8 prefixed = instruction.operands[0];
+        return (prefixed & 0xC0) == 0x40 || (prefixed & 0x07) != 0x06;
+    }
+
+    if (opcode < 0x40)
+    {
+        switch (opcode)
+        {
+        case 0x02: case 0x12: case 0x22: case 0x32: // ld [r16mem], a
+        case 0x08: // ld [imm16], sp
+        case 0x10: // stop
+        case 0x34: case 0x35: case 0x36: // inc/dec/ld [hl]
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    if (opcode < 0x80)
+    {
+        // halt, ld [hl], r8 and the ld b, b test breakpoint
+        return opcode != 0x40 && (opcode < 0x70 || opcode > 0x77);
+    }
+
+    if (opcode < 0xC0) return true;
+
+    switch (opcode)
+    {
+    case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu a, imm8
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // jp (cond), imm16
+    case 0xF0: case 0xF2: case 0xFA: // ldh a, [imm8] / ldh a, [c] / ld a, [imm16]
+    case 0xE8: case 0xF8: case 0xF9: // add sp, imm8 / ld hl, sp + imm8 / ld sp, hl
+        return true;
+    default:
+        return false;
+    }
+}
+
+// A block that jumps back to its own start and has no side effects. Whether it is really idle
+// (every pass leaves the registers as they were) can only be seen at run time.
+constexpr bool BlockCache::IsIdleLoop(const Block& block)
+{
+    if (block.instructions.empty()) return false;
+
+    const auto& last = block.instructions.back();
+    Address target;
+
+    switch (last.opcode)
+    {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr (cond), imm8
+        target = static_cast<Address>(last.address + 2 + static_cast<S8>(last.operands[0]));
+        break;
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // jp (cond), imm16
+        target = static_cast<Address>(last.operands[0] | (last.operands[1] << 8));
+        break;
+    default:
+        return false;
+    }
+
+    if (target != block.start) return false;
+
+    for (const auto& instruction : block.instructions)
+    {
+        if (!IsSideEffectFree(instruction)) return false;
+    }
+
+    return true;
+}
@@ -1,84 +1,250 @@
 #include "Bus.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <format>
 #include <iostream>
-#include <print>
 
 Bus::Bus()
 {
-    m_CartridgeROM_Bank0.resize(CARTRIDGE_BANK_ROM_SIZE);
-    m_CartridgeROM_Bank1.resize(CARTRIDGE_BANK_ROM_SIZE);
-    m_VideoRAM.resize(VIDEO_RAM_SIZE);
-    m_CartridgeRAM.resize(CARTRIDGE_RAM_SIZE);
-    m_WorkRAM.resize(WORK_RAM_SIZE);
-    m_OAM.resize(0xA0); // 160 bytes (4 bytes per object)
-    m_IO_Registers.resize(0x80); // 128 bytes for I/O Registers
-    m_HighRAM.resize(0x7F); // 127 bytes for High RAM
-    m_InterruptEnable = 0x0; // Interrupts are disabled by default
+    // The arena starts zeroed, so interrupts are disabled by default
+    MapMemory();
 }
 
-void Bus::InsertCartridge(const std::string& cartridge)
+void Bus::InsertCartridge(const std::string& cartridge, const Scheduler& scheduler)
 {
     cartridgeName = SplitString(SplitString(cartridge, "\\").back(), ".")[0];
 
-    m_Cartridge = std::make_shared<Cartridge>(cartridge);
+    m_Cartridge = std::make_unique<Cartridge>(cartridge, scheduler);
     
-    m_CartridgeROM_Bank0 = m_Cartridge->ReadROM(0, CARTRIDGE_BANK_ROM_SIZE);
-    m_CartridgeROM_Bank1 = m_Cartridge->ReadROM(CARTRIDGE_BANK_ROM_SIZE, CARTRIDGE_BANK_ROM_SIZE);
+    MapCartridge();
 }
 
-Byte Bus::Read(Address address)
+void Bus::EjectCartridge()
 {
-    if (address < 0x4000) return m_CartridgeROM_Bank0[address];
-    else if (address < 0x8000) return m_CartridgeROM_Bank1[address - 0x4000];
-    else if (address < 0xA000) return m_VideoRAM[address - 0x8000];
-    else if (address < 0xC000) return m_CartridgeRAM[address - 0xA000];
-    else if (address < 0xE000) return m_WorkRAM[address - 0xC000];
-    else if (address >= 0xFE00 && address < 0xFEA0) return m_OAM[address - 0xFE00];
-    else if (address < 0xFEFF)
+    m_Cartridge.reset();
+    MapCartridge();
+}
+
+void Bus::Restore(const Memory& memory)
+{
+    std::memcpy(&m_Memory, &memory, sizeof(Memory));
+    if (m_BlockCache != nullptr) m_BlockCache->Clear();
+    if (m_TileCache != nullptr) m_TileCache->Clear();
+}
+
+void Bus::MapRead(Address start, Size length, const Byte* memory)
+{
+    for (Size offset = 0; offset < length; offset += PAGE_SIZE)
+    {
+        m_ReadPages[(start + offset) >> 8] = memory != nullptr ? memory + offset : nullptr;
+    }
+}
+
+void Bus::MapWrite(Address start, Size length, Byte* memory)
+{
+    for (Size offset = 0; offset < length; offset += PAGE_SIZE)
+    {
+        m_WritePages[(start + offset) >> 8] = memory != nullptr ? memory + offset : nullptr;
+    }
+}
+
+void Bus::MapMemory()
+{
+    // Writes to ROM are mapper control and always take the slow path
+    MapWrite(0x0000, 2 * Cartridge::ROM_BANK_SIZE, nullptr);
+    MapCartridge();
+
+    // Tile data writes take the slow path to keep the tile cache up to date, tile map writes don't
+    MapRead(0x8000, VIDEO_RAM_SIZE, m_Memory.videoRAM.data());
+    MapWrite(0x8000, TileCache::TILE_DATA_END - 0x8000, nullptr);
+    MapWrite(TileCache::TILE_DATA_END, 0xA000 - TileCache::TILE_DATA_END,
+        m_Memory.videoRAM.data() + (TileCache::TILE_DATA_END - 0x8000));
+    MapRead(0xC000, WORK_RAM_SIZE, m_Memory.workRAM.data());
+    MapWrite(0xC000, WORK_RAM_SIZE, m_Memory.workRAM.data());
+
+    // Echo RAM, OAM, I/O, HRAM and IE
+    MapRead(0xE000, 0x2000, nullptr);
+    MapWrite(0xE000, 0x2000, nullptr);
+}
+
+void Bus::MapCartridge()
+{
+    const Byte* bank0 = m_Cartridge != nullptr ? m_Cartridge->ROMBank(0x0000) : nullptr;
+    const Byte* bank1 = m_Cartridge != nullptr ? m_Cartridge->ROMBank(0x4000) : nullptr;
+    Byte* ram = m_Cartridge != nullptr ? m_Cartridge->RAMBank() : nullptr;
+
+    // Most mapper writes select the banks that are already mapped
+    if (bank0 == m_ReadPages[0x00] && bank1 == m_ReadPages[0x40] && ram == m_WritePages[0xA0]) return;
+
+    MapRead(0x0000, Cartridge::ROM_BANK_SIZE, bank0);
+    MapRead(0x4000, Cartridge::ROM_BANK_SIZE, bank1);
+    MapRead(0xA000, Cartridge::RAM_BANK_SIZE, ram);
+    MapWrite(0xA000, Cartridge::RAM_BANK_SIZE, ram);
+
+    // Decoded blocks stay cached per bank, but whatever is executing may now see different code
+    if (m_BlockCache != nullptr) m_BlockCache->Remap();
+}
+
+void Bus::RestrictToHighRAM(bool restricted)
+{
+    if (restricted == m_HighRAMOnly) return;
+    m_HighRAMOnly = restricted;
+
+    if (restricted)
+    {
+        MapRead(0x0000, 0xFF00, nullptr);
+        MapWrite(0x0000, 0xFF00, nullptr);
+    }
+    else
+    {
+        MapMemory();
+    }
+
+    // Code fetched from below HRAM changes with the restriction, so drop the current block
+    if (m_BlockCache != nullptr) m_BlockCache->Remap();
+}
+
+Byte Bus::ReadSlow(Address address)
+{
+    if (m_HighRAMOnly && address < 0xFF00) return 0xFF;
+
+    if (address < 0x8000) return 0xFF; // No cartridge
+    else if (address < 0xA000) return m_Memory.videoRAM[address - 0x8000];
+    else if (address < 0xC000) return m_Cartridge != nullptr ? m_Cartridge->ReadRAM(address) : 0xFF;
+    else if (address < 0xE000) return m_Memory.workRAM[address - 0xC000];
+    else if (address >= 0xFE00 && address < 0xFEA0) return m_Memory.oam[address - 0xFE00];
+    else if (address < 0xFF00)
     {
         std::cerr << std::format("Attempted to read prohibited memory address: {:04X}\n", address);
         return 0xFF;
     }
-    else if (address < 0xFF7F) return m_IO_Registers[address - 0xFF00];
-    else if (address < 0xFFFF) return m_HighRAM[address - 0xFF80];
-    else return m_InterruptEnable;
+    else if (address < 0xFF80) return ReadIO(address);
+    else if (address < 0xFFFF) return m_Memory.highRAM[address - 0xFF80];
+    else return m_Memory.interruptEnable;
 
     return 0x0;
 }
 
-std::vector<Byte> Bus::Read(Address start, Size length)
+Byte Bus::ReadIO(Address address)
 {
-    auto data = std::vector<Byte>(length);
+    const Size index = address - 0xFF00;
 
-    for (Size i = start; i < start + length; i++)
+    if (m_IOHandlers[index].read)
     {
-        data.emplace_back(Read(static_cast<Address>(i)));
+        m_VolatileReads++;
+        return m_IOHandlers[index].read() | k_IOUnusedBits[index];
     }
 
-    return data;
+    return m_Memory.ioRegisters[index] | k_IOUnusedBits[index];
+}
+
+void Bus::WriteIO(Address address, Byte value)
+{
+    const Size index = address - 0xFF00;
+    const Byte readOnly = ReadOnlyBits(address);
+
+    Byte& stored = m_Memory.ioRegisters[index];
+    stored = (stored & readOnly) | (value & ~readOnly);
+
+    if (m_IOHandlers[index].write) m_IOHandlers[index].write(value);
+}
+
+void Bus::Read(Address start, std::span<Byte> destination)
+{
+    Size done = 0;
+    while (done < destination.size())
+    {
+        const Address address = static_cast<Address>(start + done);
+        const Size offset = address & (PAGE_SIZE - 1);
+        const Size run = std::min<Size>(PAGE_SIZE - offset, static_cast<Size>(destination.size()) - done);
+
+        if (const Byte* page = m_ReadPages[address >> 8])
+        {
+            std::memcpy(destination.data() + done, page + offset, run);
+        }
+        else
+        {
+            for (Size i = 0; i < run; i++) destination[done + i] = ReadSlow(static_cast<Address>(address + i));
+        }
+
+        done += run;
+    }
 }
 
-void Bus::Write(Address address, Byte value)
+void Bus::Write(Address start, std::span<const Byte> source)
 {
-    if (address == 0xFF40)
+    Size done = 0;
+    while (done < source.size())
     {
-        std::println("LCDC: {:02X}", value);
-        std::println("{}", value & 0x80 ? "LCD is on" : "LCD is off");
+        const Address address = static_cast<Address>(start + done);
+        const Size offset = address & (PAGE_SIZE - 1);
+        const Size run = std::min<Size>(PAGE_SIZE - offset, static_cast<Size>(source.size()) - done);
+
+        if (Byte* page = m_WritePages[address >> 8])
+        {
+            std::memcpy(page + offset, source.data() + done, run);
+            if (m_BlockCache != nullptr)
+            {
+                for (Size i = 0; i < run; i++) m_BlockCache->Invalidate(static_cast<Address>(address + i));
+            }
+        }
+        else
+        {
+            for (Size i = 0; i < run; i++) WriteSlow(static_cast<Address>(address + i), source[done + i]);
+        }
+
+        done += run;
+    }
+}
+
+std::span<const Byte> Bus::View(Address start, Size length) const
+{
+    if (length == 0 || start + length > 0x10000) return {};
+
+    // Every page must be mapped and follow on from the previous one in host memory
+    const Byte* first = m_ReadPages[start >> 8];
+    if (first == nullptr) return {};
+
+    const Size lastPage = (start + length - 1) >> 8;
+    for (Size page = (start >> 8) + 1; page <= lastPage; page++)
+    {
+        if (m_ReadPages[page] != first + (page - (start >> 8)) * PAGE_SIZE) return {};
+    }
+
+    return { first + (start & (PAGE_SIZE - 1)), length };
+}
+
+void Bus::WriteSlow(Address address, Byte value)
+{
+    if (m_HighRAMOnly && address < 0xFF00) return;
+
+    if (m_BlockCache != nullptr && address >= 0x8000)
+    {
+        m_BlockCache->Invalidate(address);
     }
     
     if (address < 0x8000)
     {
-        std::cerr << std::format("Attempted to write to ROM: {:04X}\n", address);
+        if (m_Cartridge != nullptr && m_Cartridge->Control(address, value)) MapCartridge();
+        else std::cerr << std::format("Attempted to write to ROM: {:04X}\n", address);
+    }
+    else if (address < 0xA000)
+    {
+        m_Memory.videoRAM[address - 0x8000] = value;
+        if (m_TileCache != nullptr) m_TileCache->Invalidate(address);
+    }
+    else if (address < 0xC000)
+    {
+        if (m_Cartridge != nullptr) m_Cartridge->WriteRAM(address, value);
     }
-    else if (address < 0xA000) m_VideoRAM[address - 0x8000] = value;
-    else if (address < 0xC000) m_CartridgeRAM[address - 0xA000] = value;
-    else if (address < 0xE000) m_WorkRAM[address - 0xC000] = value;
-    else if (address >= 0xFE00 && address < 0xFEA0) m_OAM[address - 0xFE00] = value;
+    else if (address < 0xE000) m_Memory.workRAM[address - 0xC000] = value;
+    else if (address >= 0xFE00 && address < 0xFEA0) m_Memory.oam[address - 0xFE00] = value;
     else if (address < 0xFF00)
     {
         std::cerr << std::format("Attempted to write to prohibited memory address: {:04X}\n", address);
     }
-    else if (address < 0xFF80) m_IO_Registers[address - 0xFF00] = value;
-    else if (address < 0xFFFF) m_HighRAM[address - 0xFF80] = value;
-    else m_InterruptEnable = value;
+    else if (address < 0xFF80) WriteIO(address, value);
+    else if (address < 0xFFFF) m_Memory.highRAM[address - 0xFF80] = value;
+    else m_Memory.interruptEnable = value;
 }
@@ -1,42 +1,199 @@
 #pragma once
 
+#include <array>
+#include <functional>
 #include <memory>
+#include <span>
+#include <type_traits>
 
+#include "BlockCache.hpp"
 #include "Cartridge.hpp"
+#include "TileCache.hpp"
 #include "Utility/Types.hpp"
 #include "Utility/Utils.hpp"
 
 class Bus
 {
 private: // Specifications
-    static constexpr Size CARTRIDGE_BANK_ROM_SIZE = 16_Kb;
     static constexpr Size VIDEO_RAM_SIZE = 8_Kb;
-    static constexpr Size CARTRIDGE_RAM_SIZE = 8_Kb;
     static constexpr Size WORK_RAM_SIZE = 8_Kb;
+    static constexpr Size OAM_SIZE = 0xA0; // 4 bytes per object
+    static constexpr Size IO_REGISTERS_SIZE = 0x80;
+    static constexpr Size HIGH_RAM_SIZE = 0x7F;
+
+    static constexpr Size PAGE_SIZE = 0x100;
+    static constexpr Size PAGE_COUNT = 0x10000 / PAGE_SIZE;
     
+public:
+    // Every byte of console memory, in one cache-line aligned block with a fixed layout and no heap
+    // allocations. It holds no pointers, so a memory snapshot is a single copy of it. Cartridge ROM
+    // and RAM are banked by the mapper and stay in the cartridge.
+    struct alignas(64) Memory
+    {
+        std::array<Byte, VIDEO_RAM_SIZE> videoRAM;
+        std::array<Byte, WORK_RAM_SIZE> workRAM;
+        std::array<Byte, OAM_SIZE> oam;
+        std::array<Byte, IO_REGISTERS_SIZE> ioRegisters;
+        std::array<Byte, HIGH_RAM_SIZE> highRAM;
+        Byte interruptEnable;
+    };
+
+    // Side effects of an I/O register, run at the moment of the access. A read handler computes the
+    // value itself; a write handler sees the value after the stored copy was updated.
+    using IOReadHandler = std::function<Byte()>;
+    using IOWriteHandler = std::function<void(Byte value)>;
+
 public:
     Bus();
 
-    void InsertCartridge(const std::string& cartridge);
+    Bus(const Bus&) = delete;
+    Bus& operator=(const Bus&) = delete;
+
+    // The scheduler drives clocks on the cartridge itself, like the MBC3 real-time clock
+    void InsertCartridge(const std::string& cartridge, const Scheduler& scheduler);
+    void EjectCartridge();
     std::string CartridgeName() const { return cartridgeName; }
     
-    Byte Read(Address address);
-    std::vector<Byte> Read(Address start, Size length);
+    // Plain ROM/RAM pages are a table lookup and a host memory access; I/O, OAM and everything
+    // with side effects, including writes to VRAM tile data, goes through the slow path
+    Byte Read(Address address)
+    {
+        if (const Byte* page = m_ReadPages[address >> 8]) return page[address & 0xFF];
+        return ReadSlow(address);
+    }
+
+    void Write(Address address, Byte value)
+    {
+        if (Byte* page = m_WritePages[address >> 8])
+        {
+            page[address & 0xFF] = value;
+            if (m_BlockCache != nullptr) m_BlockCache->Invalidate(address);
+            return;
+        }
+        WriteSlow(address, value);
+    }
+
+    // Bulk copies for DMA, debuggers and the like. Each page-sized run that maps straight to host
+    // memory is a single copy, the rest goes byte by byte through the slow path; the range may
+    // cross region boundaries and wraps at 0xFFFF.
+    void Read(Address start, std::span<Byte> destination);
+    void Write(Address start, std::span<const Byte> source);
+
+    // A direct view of [start, start + length) when the whole range is backed by contiguous
+    // readable memory under the current mapping, otherwise an empty span. Only valid until the
+    // next bank switch.
+    std::span<const Byte> View(Address start, Size length) const;
+
+    // The ROM bank mapped at `address`, 0 outside of ROM; code is cached per bank
+    U32 CodeBank(Address address) const
+    {
+        return address < 0x8000 && m_Cartridge != nullptr ? m_Cartridge->ROMBankNumber(address) : 0;
+    }
+
+    // Points the pages covering [start, start + length) at host memory, or at the slow path for
+    // nullptr. Bank switches and overlays only swap these pointers; both must be page aligned.
+    void MapRead(Address start, Size length, const Byte* memory);
+    void MapWrite(Address start, Size length, Byte* memory);
+
+    // The page table points into the arena, so restoring a snapshot needs no remapping; cached
+    // blocks are dropped since the code may differ
+    const Memory& Snapshot() const { return m_Memory; }
+    void Restore(const Memory& memory);
+
+    // IF (0xFF0F) and IE (0xFFFF) without going through the address decode
+    Byte InterruptFlags() const { return m_Memory.ioRegisters[0x0F]; }
+    Byte InterruptEnable() const { return m_Memory.interruptEnable; }
+    void RequestInterrupt(Byte mask) { m_Memory.ioRegisters[0x0F] |= mask; }
+    void AcknowledgeInterrupt(Byte mask) { m_Memory.ioRegisters[0x0F] &= ~mask; }
+
+    // Components hook the registers they own, the same way they register scheduler events
+    void OnRead(Address address, IOReadHandler handler) { m_IOHandlers[address - 0xFF00].read = std::move(handler); }
+    void OnWrite(Address address, IOWriteHandler handler) { m_IOHandlers[address - 0xFF00].write = std::move(handler); }
+
+    // The stored copy of an I/O register, for the component that owns it. Bypasses handlers and
+    // masks, so e.g. the LCD can update the read-only LY.
+    Byte& IO(Address address) { return m_Memory.ioRegisters[address - 0xFF00]; }
+
+    // Counts reads that went through a read handler. Such values derive from the clock and can
+    // change without a scheduled event, which the idle loop detection has to know about.
+    U32 VolatileReads() const { return m_VolatileReads; }
 
-    void Write(Address, Byte);
+    // Video memory and OAM as the PPU and the DMA unit see them, bypassing the CPU's view of the bus
+    std::span<const Byte> VideoRAM() const { return m_Memory.videoRAM; }
+    std::span<Byte> OAM() { return m_Memory.oam; }
+
+    // During OAM DMA the CPU only reaches 0xFF00-0xFFFF; everything below reads 0xFF and ignores
+    // writes. Those pages are unmapped meanwhile, so the fast path needs no extra check.
+    void RestrictToHighRAM(bool restricted);
+    bool HighRAMOnly() const { return m_HighRAMOnly; }
+
+    // The page tables and HRAM, for the recompiler's inline memory accesses
+    const Byte* const* ReadPages() const { return m_ReadPages.data(); }
+    Byte* const* WritePages() const { return m_WritePages.data(); }
+    Byte* HighRAM() { return m_Memory.highRAM.data(); }
+
+    void SetBlockCache(BlockCache* blockCache) { m_BlockCache = blockCache; }
+    void SetTileCache(TileCache* tileCache) { m_TileCache = tileCache; }
     
-    std::shared_ptr<Cartridge> m_Cartridge;
+    std::unique_ptr<Cartridge> m_Cartridge;
+private:
+    Byte ReadSlow(Address address);
+    void WriteSlow(Address address, Byte value);
+    void MapMemory();
+    void MapCartridge();
+
+    Byte ReadIO(Address address);
+    void WriteIO(Address address, Byte value);
+
+    static constexpr Byte ReadOnlyBits(Address address);
+
 private:
+    // Bits of each I/O register that read as 1: unused and write-only bits, unmapped registers and
+    // joypad lines with nothing pressed
+    static inline constexpr Byte k_IOUnusedBits[IO_REGISTERS_SIZE] = {
+        0xCF, 0x00, 0x7E, 0xFF, 0x00, 0x00, 0x00, 0xF8, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xE0, // Joypad, serial, timer, IF
+        0x80, 0x3F, 0x00, 0xFF, 0xBF, 0xFF, 0x3F, 0x00, 0xFF, 0xBF, 0x7F, 0xFF, 0x9F, 0xFF, 0xBF, 0xFF, // Sound channels 1-3
+        0xFF, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // Sound channel 4, control
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // Wave RAM
+        0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, // LCD
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+    };
 
-    std::vector<Byte> m_CartridgeROM_Bank0;
-    std::vector<Byte> m_CartridgeROM_Bank1;
-    std::vector<Byte> m_VideoRAM;
-    std::vector<Byte> m_CartridgeRAM;
-    std::vector<Byte> m_WorkRAM;
-    std::vector<Byte> m_OAM;
-    std::vector<Byte> m_IO_Registers;
-    std::vector<Byte> m_HighRAM;
-    Byte m_InterruptEnable;
+private:
+    std::array<const Byte*, PAGE_COUNT> m_ReadPages {};
+    std::array<Byte*, PAGE_COUNT> m_WritePages {};
+
+    Memory m_Memory {};
+
+    struct IOHandlers
+    {
+        IOReadHandler read;
+        IOWriteHandler write;
+    };
+
+    std::array<IOHandlers, IO_REGISTERS_SIZE> m_IOHandlers;
+    U32 m_VolatileReads = 0;
+    bool m_HighRAMOnly = false;
+
+    BlockCache* m_BlockCache = nullptr;
+    TileCache* m_TileCache = nullptr;
 
     std::string cartridgeName;
 };
+
+static_assert(std::is_trivially_copyable_v<Bus::Memory>);
+
+// Bits that only the hardware changes; CPU writes leave them as they are
+constexpr Byte Bus::ReadOnlyBits(Address address)
+{
+    switch (address)
+    {
+    case 0xFF00: return 0x0F; // Joypad lines
+    case 0xFF26: return 0x0F; // Sound channel status
+    case 0xFF41: return 0x07; // STAT coincidence and mode
+    case 0xFF44: return 0xFF; // LY
+    default: return 0x00;
+    }
+}
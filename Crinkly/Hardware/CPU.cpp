@@ -1,5 +1,7 @@
 #include "CPU.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <filesystem>
 #include <iostream>
 #include <print>
@@ -7,48 +9,13 @@
 
 // #define PRINT_INSTRUCTION
 
-static int gpuCounter = 0;
-static int frame = 0;
-static int counter = 0;
-static int lastCounter = 0;
-
-CPU::CPU(const std::shared_ptr<Bus>& bus, const std::shared_ptr<LCD>& lcd)
-{
-    m_Registers[Register8::A] = 0;
-    m_Registers[Register8::B] = 0;
-    m_Registers[Register8::C] = 0;
-    m_Registers[Register8::D] = 0;
-    m_Registers[Register8::E] = 0;
-    m_Registers[Register8::F] = 0;
-    m_Registers[Register8::H] = 0;
-    m_Registers[Register8::L] = 0;
-    
-    m_Bus = bus;
-    m_LCD = lcd;
-    
-    m_R8[0] = Register8::B;
-    m_R8[1] = Register8::C;
-    m_R8[2] = Register8::D;
-    m_R8[3] = Register8::E;
-    m_R8[4] = Register8::H;
-    m_R8[5] = Register8::L;
-    m_R8[6] = Register8::HL;
-    m_R8[7] = Register8::A;
-
-    m_R16[0] = Register16::BC;
-    m_R16[1] = Register16::DE;
-    m_R16[2] = Register16::HL;
-    m_R16[3] = Register16::SP;
-
-    m_R16stk[0] = Register16::BC;
-    m_R16stk[1] = Register16::DE;
-    m_R16stk[2] = Register16::HL;
-    m_R16stk[3] = Register16::AF;
-
-    m_R16mem[0] = Register16::BC;
-    m_R16mem[1] = Register16::DE;
-    m_R16mem[2] = Register16::HLi;
-    m_R16mem[3] = Register16::HLd;
+
+CPU::CPU(Bus& bus, Scheduler& scheduler) : m_Bus(bus), m_Scheduler(scheduler)
+{
+    m_Registers.AF = 0;
+    m_Registers.BC = 0;
+    m_Registers.DE = 0;
+    m_Registers.HL = 0;
 
     m_SP = 0x0000;
     m_PC = 0x0000;
@@ -56,8 +23,28 @@ CPU::CPU(const std::shared_ptr<Bus>& bus, const std::shared_ptr<LCD>& lcd)
     m_IME_Next_Cycle = false;
     m_Interrupting = false;
     m_Wait = 0;
+    m_Halted = false;
+    m_HaltBug = false;
+    m_SkipIdleLoops = true;
+
+    m_Cursor = nullptr;
+    m_BlockEnd = nullptr;
+    m_BlockGeneration = 0;
+    m_Immediate = nullptr;
+    m_Cycles = 0;
+    m_Bus.SetBlockCache(&m_BlockCache);
+
+#ifdef RECOMPILER
+    m_NativeStart = 0;
+    m_NativeDeadline = 0;
+    m_NativeCycles = 0;
+    m_NativeResume = Scheduler::NEVER;
+
+    // Cleared blocks take their translations with them
+    m_BlockCache.OnClear([this] { m_Recompiler.Reset(); });
+#endif
 
-    m_Log.open(std::format("{}.log", bus->CartridgeName()));
+    m_Log.open(std::format("{}.log", m_Bus.CartridgeName()));
 }
 
 void CPU::Bootstrap()
@@ -72,41 +59,38 @@ void CPU::Bootstrap()
     Register(Register8::L, 0x4D);
     Register(Register16::SP, 0xFFFE);
     Register(Register16::PC, 0x0100);
-    if (auto bus = m_Bus.lock())
-    {
-        bus->Write(0xFF00, 0xFF);
-        bus->Write(0xFF05, 0x00);
-        bus->Write(0xFF06, 0x00);
-        bus->Write(0xFF07, 0x00);
-        bus->Write(0xFF10, 0x80);
-        bus->Write(0xFF11, 0xBF);
-        bus->Write(0xFF12, 0xF3);
-        bus->Write(0xFF14, 0xBF);
-        bus->Write(0xFF16, 0x3F);
-        bus->Write(0xFF17, 0x00);
-        bus->Write(0xFF19, 0xBF);
-        bus->Write(0xFF1A, 0x7F);
-        bus->Write(0xFF1B, 0xFF);
-        bus->Write(0xFF1C, 0x9F);
-        bus->Write(0xFF1E, 0xBF);
-        bus->Write(0xFF20, 0xFF);
-        bus->Write(0xFF21, 0x00);
-        bus->Write(0xFF22, 0x00);
-        bus->Write(0xFF23, 0xBF);
-        bus->Write(0xFF24, 0x77);
-        bus->Write(0xFF25, 0xF3);
-        bus->Write(0xFF26, 0xF1);
-        bus->Write(0xFF40, 0x91);
-        bus->Write(0xFF42, 0x00);
-        bus->Write(0xFF43, 0x00);
-        bus->Write(0xFF45, 0x00);
-        bus->Write(0xFF47, 0xFC);
-        bus->Write(0xFF48, 0xFF);
-        bus->Write(0xFF49, 0xFF);
-        bus->Write(0xFF4A, 0x00);
-        bus->Write(0xFF4B, 0x00);
-        bus->Write(0xFFFF, 0x00);
-    }
+    m_Bus.Write(0xFF00, 0xFF);
+    m_Bus.Write(0xFF05, 0x00);
+    m_Bus.Write(0xFF06, 0x00);
+    m_Bus.Write(0xFF07, 0x00);
+    m_Bus.Write(0xFF10, 0x80);
+    m_Bus.Write(0xFF11, 0xBF);
+    m_Bus.Write(0xFF12, 0xF3);
+    m_Bus.Write(0xFF14, 0xBF);
+    m_Bus.Write(0xFF16, 0x3F);
+    m_Bus.Write(0xFF17, 0x00);
+    m_Bus.Write(0xFF19, 0xBF);
+    m_Bus.Write(0xFF1A, 0x7F);
+    m_Bus.Write(0xFF1B, 0xFF);
+    m_Bus.Write(0xFF1C, 0x9F);
+    m_Bus.Write(0xFF1E, 0xBF);
+    m_Bus.Write(0xFF20, 0xFF);
+    m_Bus.Write(0xFF21, 0x00);
+    m_Bus.Write(0xFF22, 0x00);
+    m_Bus.Write(0xFF23, 0xBF);
+    m_Bus.Write(0xFF24, 0x77);
+    m_Bus.Write(0xFF25, 0xF3);
+    m_Bus.Write(0xFF26, 0xF1);
+    m_Bus.Write(0xFF40, 0x91);
+    m_Bus.Write(0xFF42, 0x00);
+    m_Bus.Write(0xFF43, 0x00);
+    m_Bus.Write(0xFF45, 0x00);
+    m_Bus.Write(0xFF47, 0xFC);
+    m_Bus.Write(0xFF48, 0xFF);
+    m_Bus.Write(0xFF49, 0xFF);
+    m_Bus.Write(0xFF4A, 0x00);
+    m_Bus.Write(0xFF4B, 0x00);
+    m_Bus.Write(0xFFFF, 0x00);
 }
 
 #pragma region CPU
@@ -115,13 +99,11 @@ U8 CPU::Register(Register8 reg)
 {
     if (reg == Register8::HL)
     {
-        if (const auto bus = m_Bus.lock())
-        {
-            return bus->Read(Register(Register16::HL));
-        }
-        return 0;
+        return m_Bus.Read(Register(Register16::HL));
     }
 
+    if (reg == Register8::F) return PackFlags();
+
     return reg == Register8::Imm8 ? ReadImm8() : m_Registers[reg];
 }
 
@@ -134,15 +116,15 @@ U16 CPU::Register(Register16 reg)
     case Register16::PC:
         return m_PC;
     case Register16::AF:
-        return static_cast<U16>(m_Registers[Register8::A] << 8) | m_Registers[Register8::F];
+        return static_cast<U16>(m_Registers.A << 8 | PackFlags());
     case Register16::BC:
-        return static_cast<U16>(m_Registers[Register8::B] << 8) | m_Registers[Register8::C];
+        return m_Registers.BC;
     case Register16::DE:
-        return static_cast<U16>(m_Registers[Register8::D] << 8) | m_Registers[Register8::E];
+        return m_Registers.DE;
     case Register16::HLi:
     case Register16::HLd:
     case Register16::HL:
-        return static_cast<U16>(m_Registers[Register8::H] << 8) | m_Registers[Register8::L];
+        return m_Registers.HL;
     case Register16::Imm16:
         return ReadImm16();
     }
@@ -154,14 +136,12 @@ void CPU::Register(Register8 reg, const U8 value)
 {
     if (reg == Register8::HL)
     {
-        if (const auto bus = m_Bus.lock())
-        {
-            bus->Write(Register(Register16::HL), value);
-        }
+        m_Bus.Write(Register(Register16::HL), value);
         return;
     }
 
-    m_Registers[reg] = value;
+    if (reg == Register8::F) UnpackFlags(value);
+    else m_Registers[reg] = value;
 }
 
 void CPU::Register(Register16 reg, const U16& value)
@@ -169,20 +149,17 @@ void CPU::Register(Register16 reg, const U16& value)
     switch (reg)
     {
     case Register16::AF:
-        m_Registers[Register8::A] = value >> 8;
-        m_Registers[Register8::F] = value & 0xF0;
+        m_Registers.A = static_cast<U8>(value >> 8);
+        UnpackFlags(static_cast<U8>(value));
         break;
     case Register16::BC:
-        m_Registers[Register8::B] = value >> 8;
-        m_Registers[Register8::C] = value & 0xFF;
+        m_Registers.BC = value;
         break;
     case Register16::DE:
-        m_Registers[Register8::D] = value >> 8;
-        m_Registers[Register8::E] = value & 0xFF;
+        m_Registers.DE = value;
         break;
     case Register16::HL:
-        m_Registers[Register8::H] = value >> 8;
-        m_Registers[Register8::L] = value & 0xFF;
+        m_Registers.HL = value;
         break;
     case Register16::SP:
         m_SP = value;
@@ -195,25 +172,123 @@ void CPU::Register(Register16 reg, const U16& value)
         std::println("Cannot write to indirect register");
         break;
     case Register16::Imm16:
-        if (const auto bus = m_Bus.lock())
-        {
-            const Address address = ReadImm16();
-            bus->Write(address, static_cast<U8>(value));
-        }
+        m_Bus.Write(ReadImm16(), static_cast<U8>(value));
         break;
     }
 }
 
+template <CPU::Register8 reg>
+U8 CPU::Register()
+{
+    if constexpr (reg == Register8::HL)
+    {
+        return m_Bus.Read(m_Registers.HL);
+    }
+    else if constexpr (reg == Register8::Imm8)
+    {
+        return ReadImm8();
+    }
+    else if constexpr (reg == Register8::F)
+    {
+        return PackFlags();
+    }
+    else
+    {
+        return m_Registers[reg];
+    }
+}
+
+template <CPU::Register16 reg>
+U16 CPU::Register()
+{
+    if constexpr (reg == Register16::AF) return static_cast<U16>(m_Registers.A << 8 | PackFlags());
+    else if constexpr (reg == Register16::BC) return m_Registers.BC;
+    else if constexpr (reg == Register16::DE) return m_Registers.DE;
+    else if constexpr (reg == Register16::HL || reg == Register16::HLi || reg == Register16::HLd) return m_Registers.HL;
+    else if constexpr (reg == Register16::SP) return m_SP;
+    else if constexpr (reg == Register16::PC) return m_PC;
+    else return ReadImm16();
+}
+
+template <CPU::Register8 reg>
+void CPU::Register(const U8 value)
+{
+    static_assert(reg != Register8::Imm8, "Cannot write to an immediate");
+
+    if constexpr (reg == Register8::HL)
+    {
+        m_Bus.Write(m_Registers.HL, value);
+    }
+    else if constexpr (reg == Register8::F)
+    {
+        UnpackFlags(value);
+    }
+    else
+    {
+        m_Registers[reg] = value;
+    }
+}
+
+template <CPU::Register16 reg>
+void CPU::Register(const U16 value)
+{
+    static_assert(reg != Register16::HLi && reg != Register16::HLd, "Cannot write to indirect register");
+
+    if constexpr (reg == Register16::AF)
+    {
+        m_Registers.A = static_cast<U8>(value >> 8);
+        UnpackFlags(static_cast<U8>(value));
+    }
+    else if constexpr (reg == Register16::BC) m_Registers.BC = value;
+    else if constexpr (reg == Register16::DE) m_Registers.DE = value;
+    else if constexpr (reg == Register16::HL) m_Registers.HL = value;
+    else if constexpr (reg == Register16::SP) m_SP = value;
+    else if constexpr (reg == Register16::PC) m_PC = value;
+    else
+    {
+        const Address address = ReadImm16();
+        m_Bus.Write(address, static_cast<U8>(value));
+    }
+}
+
 void CPU::Flag(Flags flag, bool set)
 {
-    m_Registers[Register8::F] = set
-                                    ? m_Registers[Register8::F] | static_cast<U8>(flag)
-                                    : m_Registers[Register8::F] & ~static_cast<U8>(flag);
+    switch (flag)
+    {
+    case Flags::Z: m_Flags.zero = set ? 0x00 : 0x01; break;
+    case Flags::N: m_Flags.subtract = set; break;
+    case Flags::H: m_Flags.half = set ? 0x10 : 0x00; break;
+    case Flags::C: m_Flags.carry = set ? 0x100 : 0x000; break;
+    }
 }
 
-bool CPU::Flag(Flags flag)
+bool CPU::Flag(Flags flag) const
 {
-    return m_Registers[Register8::F] & static_cast<U8>(flag);
+    switch (flag)
+    {
+    case Flags::Z: return m_Flags.zero == 0x00;
+    case Flags::N: return m_Flags.subtract;
+    case Flags::H: return m_Flags.half & 0x10;
+    case Flags::C: return m_Flags.carry & 0x100;
+    }
+
+    return false;
+}
+
+U8 CPU::PackFlags() const
+{
+    return static_cast<U8>((m_Flags.zero == 0x00 ? static_cast<U8>(Flags::Z) : 0x00) |
+                           (m_Flags.subtract ? static_cast<U8>(Flags::N) : 0x00) |
+                           ((m_Flags.half & 0x10) << 1) |
+                           ((m_Flags.carry & 0x100) >> 4));
+}
+
+void CPU::UnpackFlags(U8 flags)
+{
+    m_Flags.zero = (flags & static_cast<U8>(Flags::Z)) ? 0x00 : 0x01;
+    m_Flags.subtract = flags & static_cast<U8>(Flags::N);
+    m_Flags.half = static_cast<U8>((flags & static_cast<U8>(Flags::H)) >> 1);
+    m_Flags.carry = static_cast<U16>((flags & static_cast<U8>(Flags::C)) << 4);
 }
 
 bool CPU::Condition(U8 condition)
@@ -230,44 +305,46 @@ bool CPU::Condition(U8 condition)
     return false;
 }
 
+template <U8 condition>
+bool CPU::Condition()
+{
+    static_assert(condition < 0x04, "Unknown condition");
+
+    if constexpr (condition == 0x00) return m_Flags.zero != 0x00;
+    else if constexpr (condition == 0x01) return m_Flags.zero == 0x00;
+    else if constexpr (condition == 0x02) return !(m_Flags.carry & 0x100);
+    else return m_Flags.carry & 0x100;
+}
+
 #pragma endregion
 
 #pragma region CPU Read
 U8 CPU::ReadImm8()
 {
-    if (const auto bus = m_Bus.lock())
-    {
 #ifdef PRINT_INSTRUCTION
-        std::println("Reading from 0x{:04X} -> {:02X}", m_PC, bus->Read(m_PC));
+    std::println("Reading from 0x{:04X} -> {:02X}", m_PC, *m_Immediate);
 #endif
-        return bus->Read(m_PC++);
-    }
-
-    return 0x00;
+    m_PC++;
+    return *m_Immediate++;
 }
 
 U16 CPU::ReadImm16()
 {
-    if (const auto bus = m_Bus.lock())
-    {
 #ifdef PRINT_INSTRUCTION
-        std::println("Reading from 0x{:04X} -> {:02X}", m_PC, bus->Read(m_PC));
-        std::println("Reading from 0x{:04X} -> {:02X}", m_PC + 1, bus->Read(m_PC + 1));
+    std::println("Reading from 0x{:04X} -> {:02X}", m_PC, m_Immediate[0]);
+    std::println("Reading from 0x{:04X} -> {:02X}", m_PC + 1, m_Immediate[1]);
 #endif
-        return static_cast<U16>(bus->Read(m_PC++)) | static_cast<U16>(bus->Read(m_PC++) << 8);
-    }
-
-    return 0x0000;
+    m_PC += 2;
+    const U16 value = static_cast<U16>(m_Immediate[0]) | static_cast<U16>(m_Immediate[1] << 8);
+    m_Immediate += 2;
+    return value;
 }
 #pragma endregion
 
 #pragma region CPU Stack
 void CPU::Push(U8 value)
 {
-    if (auto bus = m_Bus.lock())
-    {
-        bus->Write(--m_SP, value);
-    }
+    m_Bus.Write(--m_SP, value);
 }
 
 void CPU::Push(U16 value)
@@ -285,11 +362,7 @@ void CPU::Push(Register16 reg)
 
 U8 CPU::Pop()
 {
-    if (auto bus = m_Bus.lock())
-    {
-        return bus->Read(m_SP++);
-    }
-    exit(1);
+    return m_Bus.Read(m_SP++);
 }
 
 void CPU::Pop(Register16 reg)
@@ -307,768 +380,426 @@ U16 CPU::Pop16()
     value |= static_cast<U16>(Pop() << 8);
     return value;
 }
+
+template <CPU::Register16 reg>
+void CPU::Push()
+{
+    Push(Register<reg>());
+}
+
+template <CPU::Register16 reg>
+void CPU::Pop()
+{
+    Register<reg>(Pop16());
+}
 #pragma endregion
 #pragma endregion
 
 void CPU::SavePixels()
 {
     return;
-    if (const auto bus = m_Bus.lock())
+    std::string folder = std::format("frames/{}/Tile Blocks", m_Bus.CartridgeName());
+    std::filesystem::create_directories(folder);
+
+    std::ofstream tileBlock(std::format("{}/{}.bmp", folder, m_Scheduler.Now()));
+
+    U8 header[54] = {
+        0x42, 0x4D,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        54, 0, 0, 0,
+        40, 0, 0, 0,
+        128, 0, 0, 0,
+        192, 0, 0, 0,
+        1, 0,
+        24, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0
+    };
+
+    int fileSize = 54 + 192 * 128 * 3;
+    header[2] = static_cast<U8>(fileSize & 0xFF);
+    header[3] = static_cast<U8>((fileSize >> 8) & 0xFF);
+    header[4] = static_cast<U8>((fileSize >> 16) & 0xFF);
+    header[5] = static_cast<U8>((fileSize >> 24) & 0xFF);
+
+    tileBlock.write(reinterpret_cast<char*>(header), 54);
+
+    for (S32 ty = 23; ty >= 0; ty--)
     {
-        std::string folder = std::format("frames/{}/Tile Blocks", bus->CartridgeName());
-        std::filesystem::create_directories(folder);
-
-        std::ofstream tileBlock(std::format("{}/{}.bmp", folder, frame));
-
-        U8 header[54] = {
-            0x42, 0x4D,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            54, 0, 0, 0,
-            40, 0, 0, 0,
-            128, 0, 0, 0,
-            192, 0, 0, 0,
-            1, 0,
-            24, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0
-        };
-
-        int fileSize = 54 + 192 * 128 * 3;
-        header[2] = static_cast<U8>(fileSize & 0xFF);
-        header[3] = static_cast<U8>((fileSize >> 8) & 0xFF);
-        header[4] = static_cast<U8>((fileSize >> 16) & 0xFF);
-        header[5] = static_cast<U8>((fileSize >> 24) & 0xFF);
-
-        tileBlock.write(reinterpret_cast<char*>(header), 54);
-
-        for (S32 ty = 23; ty >= 0; ty--)
+        for (S32 y = 7; y >= 0; y--)
         {
-            for (S32 y = 7; y >= 0; y--)
+            for (S32 tx = 0; tx < 16; tx++)
             {
-                for (S32 tx = 0; tx < 16; tx++)
+                for (S32 x = 0; x < 8; x++)
                 {
-                    for (S32 x = 0; x < 8; x++)
+                    if (tx == 0 && x == 0 || (tx == 15 && x == 7))
                     {
-                        if (tx == 0 && x == 0 || (tx == 15 && x == 7))
+                        if (ty < 8)
                         {
-                            if (ty < 8)
-                            {
-                                tileBlock.put(static_cast<U8>(255));
-                                tileBlock.put(0);
-                                tileBlock.put(0);
-                            }
-                            else if (ty < 16)
-                            {
-                                tileBlock.put(0);
-                                tileBlock.put(static_cast<U8>(255));
-                                tileBlock.put(0);
-                            }
-                            else
-                            {
-                                tileBlock.put(0);
-                                tileBlock.put(0);
-                                tileBlock.put(static_cast<U8>(255));
-                            }
+                            tileBlock.put(static_cast<U8>(255));
+                            tileBlock.put(0);
+                            tileBlock.put(0);
+                        }
+                        else if (ty < 16)
+                        {
+                            tileBlock.put(0);
+                            tileBlock.put(static_cast<U8>(255));
+                            tileBlock.put(0);
+                        }
+                        else
+                        {
+                            tileBlock.put(0);
+                            tileBlock.put(0);
+                            tileBlock.put(static_cast<U8>(255));
+                        }
+                        continue;
+                    }
+                    else if (y == 7)
+                    {
+                        if (ty == 7)
+                        {
+                            tileBlock.put(static_cast<U8>(255));
+                            tileBlock.put(0);
+                            tileBlock.put(0);
+                            continue;
+                        }
+                        else if (ty == 15)
+                        {
+                            tileBlock.put(0);
+                            tileBlock.put(static_cast<U8>(255));
+                            tileBlock.put(0);
+                            continue;
+                        }
+                        else if (ty == 23)
+                        {
+                            tileBlock.put(0);
+                            tileBlock.put(0);
+                            tileBlock.put(static_cast<U8>(255));
                             continue;
                         }
-                        else if (y == 7)
+                    }
+                    else if (y == 0)
+                    {
+                        if (ty == 0)
                         {
-                            if (ty == 7)
-                            {
-                                tileBlock.put(static_cast<U8>(255));
-                                tileBlock.put(0);
-                                tileBlock.put(0);
-                                continue;
-                            }
-                            else if (ty == 15)
-                            {
-                                tileBlock.put(0);
-                                tileBlock.put(static_cast<U8>(255));
-                                tileBlock.put(0);
-                                continue;
-                            }
-                            else if (ty == 23)
-                            {
-                                tileBlock.put(0);
-                                tileBlock.put(0);
-                                tileBlock.put(static_cast<U8>(255));
-                                continue;
-                            }
+                            tileBlock.put(static_cast<U8>(255));
+                            tileBlock.put(0);
+                            tileBlock.put(0);
+                            continue;
                         }
-                        else if (y == 0)
+                        else if (ty == 8)
                         {
-                            if (ty == 0)
-                            {
-                                tileBlock.put(static_cast<U8>(255));
-                                tileBlock.put(0);
-                                tileBlock.put(0);
-                                continue;
-                            }
-                            else if (ty == 8)
-                            {
-                                tileBlock.put(0);
-                                tileBlock.put(static_cast<U8>(255));
-                                tileBlock.put(0);
-                                continue;
-                            }
-                            else if (ty == 16)
-                            {
-                                tileBlock.put(0);
-                                tileBlock.put(0);
-                                tileBlock.put(static_cast<U8>(255));
-                                continue;
-                            }
+                            tileBlock.put(0);
+                            tileBlock.put(static_cast<U8>(255));
+                            tileBlock.put(0);
+                            continue;
                         }
+                        else if (ty == 16)
+                        {
+                            tileBlock.put(0);
+                            tileBlock.put(0);
+                            tileBlock.put(static_cast<U8>(255));
+                            continue;
+                        }
+                    }
 
-                        U16 byteStride = static_cast<U16>(ty * 16 + tx) * 16;
-                        U16 address = 0x8000 + byteStride + static_cast<U16>(y * 2);
+                    U16 byteStride = static_cast<U16>(ty * 16 + tx) * 16;
+                    U16 address = 0x8000 + byteStride + static_cast<U16>(y * 2);
 
-                        U8 leftByte = bus->Read(address);
-                        U8 rightByte = bus->Read(address + 1);
+                    U8 leftByte = m_Bus.Read(address);
+                    U8 rightByte = m_Bus.Read(address + 1);
 
-                        U8 lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
-                        U8 msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
+                    U8 lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
+                    U8 msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
 
-                        U8 pixel = static_cast<U8>(msb << 1) | lsb;
+                    U8 pixel = static_cast<U8>(msb << 1) | lsb;
 
-                        tileBlock.put(pixel * 85);
-                        tileBlock.put(pixel * 85);
-                        tileBlock.put(pixel * 85);
-                    }
+                    tileBlock.put(pixel * 85);
+                    tileBlock.put(pixel * 85);
+                    tileBlock.put(pixel * 85);
                 }
             }
         }
+    }
 
-        folder = std::format("frames/{}/Tile Maps", bus->CartridgeName());
-        std::filesystem::create_directories(folder);
-
-        std::ofstream tileMap1(std::format("{}/1-{}.bmp", folder, frame));
-        std::ofstream tileMap2(std::format("{}/2-{}.bmp", folder, frame));
-
-        U8 tileMapHeader[54] = {
-            0x42, 0x4D,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            54, 0, 0, 0,
-            40, 0, 0, 0,
-            0, 1, 0, 0,
-            0, 1, 0, 0,
-            1, 0,
-            24, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0,
-            0, 0, 0, 0
-        };
-
-        fileSize = 54 + 256 * 256 * 3;
-        tileMapHeader[2] = static_cast<U8>(fileSize & 0xFF);
-        tileMapHeader[3] = static_cast<U8>((fileSize >> 8) & 0xFF);
-        tileMapHeader[4] = static_cast<U8>((fileSize >> 16) & 0xFF);
-        tileMapHeader[5] = static_cast<U8>((fileSize >> 24) & 0xFF);
-
-        tileMap1.write(reinterpret_cast<char*>(tileMapHeader), 54);
-        tileMap2.write(reinterpret_cast<char*>(tileMapHeader), 54);
-
-        for (S32 ty = 31; ty >= 0; ty--)
+    folder = std::format("frames/{}/Tile Maps", m_Bus.CartridgeName());
+    std::filesystem::create_directories(folder);
+
+    std::ofstream tileMap1(std::format("{}/1-{}.bmp", folder, m_Scheduler.Now()));
+    std::ofstream tileMap2(std::format("{}/2-{}.bmp", folder, m_Scheduler.Now()));
+
+    U8 tileMapHeader[54] = {
+        0x42, 0x4D,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        54, 0, 0, 0,
+        40, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 1, 0, 0,
+        1, 0,
+        24, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0,
+        0, 0, 0, 0
+    };
+
+    fileSize = 54 + 256 * 256 * 3;
+    tileMapHeader[2] = static_cast<U8>(fileSize & 0xFF);
+    tileMapHeader[3] = static_cast<U8>((fileSize >> 8) & 0xFF);
+    tileMapHeader[4] = static_cast<U8>((fileSize >> 16) & 0xFF);
+    tileMapHeader[5] = static_cast<U8>((fileSize >> 24) & 0xFF);
+
+    tileMap1.write(reinterpret_cast<char*>(tileMapHeader), 54);
+    tileMap2.write(reinterpret_cast<char*>(tileMapHeader), 54);
+
+    for (S32 ty = 31; ty >= 0; ty--)
+    {
+        for (S32 y = 7; y >= 0; y--)
         {
-            for (S32 y = 7; y >= 0; y--)
+            for (S32 tx = 0; tx < 32; tx++)
             {
-                for (S32 tx = 0; tx < 32; tx++)
+                for (S32 x = 0; x < 8; x++)
                 {
-                    for (S32 x = 0; x < 8; x++)
-                    {
-                        U16 addressOffset = 0x9800 + static_cast<U16>(ty * 32 + tx);
-                        U16 tileIndex = bus->Read(addressOffset);
-                        U16 address = 0x8000 + tileIndex * 16 + static_cast<U16>(y * 2);
+                    U16 addressOffset = 0x9800 + static_cast<U16>(ty * 32 + tx);
+                    U16 tileIndex = m_Bus.Read(addressOffset);
+                    U16 address = 0x8000 + tileIndex * 16 + static_cast<U16>(y * 2);
 
-                        U8 leftByte = bus->Read(address);
-                        U8 rightByte = bus->Read(address + 1);
+                    U8 leftByte = m_Bus.Read(address);
+                    U8 rightByte = m_Bus.Read(address + 1);
 
-                        U8 lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
-                        U8 msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
+                    U8 lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
+                    U8 msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
 
-                        U8 pixel = static_cast<U8>(msb << 1) | lsb;
+                    U8 pixel = static_cast<U8>(msb << 1) | lsb;
 
-                        tileMap1.put(pixel * 85);
-                        tileMap1.put(pixel * 85);
-                        tileMap1.put(pixel * 85);
+                    tileMap1.put(pixel * 85);
+                    tileMap1.put(pixel * 85);
+                    tileMap1.put(pixel * 85);
 
-                        addressOffset = 0x9C00 + static_cast<U16>(ty * 32 + tx);
-                        tileIndex = bus->Read(addressOffset);
-                        address = 0x8000 + tileIndex * 16 + static_cast<U16>(y * 2);
+                    addressOffset = 0x9C00 + static_cast<U16>(ty * 32 + tx);
+                    tileIndex = m_Bus.Read(addressOffset);
+                    address = 0x8000 + tileIndex * 16 + static_cast<U16>(y * 2);
 
-                        leftByte = bus->Read(address);
-                        rightByte = bus->Read(address + 1);
+                    leftByte = m_Bus.Read(address);
+                    rightByte = m_Bus.Read(address + 1);
 
-                        lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
-                        msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
+                    lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
+                    msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
 
-                        pixel = static_cast<U8>(msb << 1) | lsb;
+                    pixel = static_cast<U8>(msb << 1) | lsb;
 
-                        tileMap2.put(pixel * 85);
-                        tileMap2.put(pixel * 85);
-                        tileMap2.put(pixel * 85);
-                    }
+                    tileMap2.put(pixel * 85);
+                    tileMap2.put(pixel * 85);
+                    tileMap2.put(pixel * 85);
                 }
             }
         }
-
-        system("pause");
     }
+
+    system("pause");
 }
 
 std::string str;
 U8 PCMEM[4];
 
-void CPU::Step()
+U32 CPU::Step()
+{
+    return Step(m_Bus, Scheduler::NEVER);
+}
+
+U64 CPU::Run(U64 cycles)
 {
-    if (auto bus = m_Bus.lock())
+    const U64 start = m_Scheduler.Now();
+    const U64 end = start + cycles;
+
+#ifdef THREADED_DISPATCH
+    StepThreaded(m_Bus, end);
+#else
+    while (m_Scheduler.Now() < end && Running())
     {
-        while (m_PC < 0xFFFF)
+#ifdef RECOMPILER
+        if (RunNative(m_Bus, end)) continue;
+#endif
+        Step(m_Bus, end);
+    }
+#endif
+
+    return m_Scheduler.Now() - start;
+}
+
+U32 CPU::Step(Bus& bus, U64 end)
+{
+    m_Cycles = 0;
+
+    if (m_Halted)
+    {
+        if ((bus.InterruptFlags() & bus.InterruptEnable() & 0x1F) == 0)
         {
-            bus->Write(0xFF00, 0xFF);
+            // Only a scheduled event can raise an interrupt, so skip straight to the next one
+            const U64 now = m_Scheduler.Now();
+            const U64 wake = std::min({ std::max(m_Scheduler.NextDeadline(), now + 4), end, now + k_MaxHaltSkip });
+            m_Cycles = static_cast<U32>((wake - now + 3) & ~3ull);
 
-            if (Register(Register8::A) == 0x42 && Register(Register8::B) == 0x42 && Register(Register8::C) == 0x42 &&
-                Register(Register8::D) == 0x42 && Register(Register8::E) == 0x42 && Register(Register8::H) == 0x42
-                && Register(Register8::L) == 0x42)
-            {
-                std::println("Failed!");
-                system("pause");
-            }
+            m_Scheduler.Advance(m_Cycles);
+            return m_Cycles;
+        }
 
-            if (Register(Register8::B) == 3 && Register(Register8::C) == 5 && Register(Register8::D) == 8 &&
-                Register(Register8::E) == 13 && Register(Register8::H) == 21 && Register(Register8::L) == 34)
-            {
-                std::println("Success!");
-                system("pause");
-            }
+        m_Halted = false;
+    }
 
-            bus->Write(0xFF44, static_cast<U8>(gpuCounter / 456));
+    if (m_SkipIdleLoops && !m_HaltBug && AtBlockBoundary() && SkipIdleLoop(EnterBlock(bus), end)) return m_Cycles;
 
-            // 167_850
+    ServiceInterrupts(bus);
 
-            if (bus->Read(0xFF44) == bus->Read(0xFF45))
-            {
-                bus->Write(0xFF41, bus->Read(0xFF41) | 0x04);
-            }
+    if (m_HaltBug)
+    {
+        // The byte after halt is read twice: the opcode fetch fails to increment PC
+        m_HaltBug = false;
+        m_HaltBugOperands[0] = bus.Read(m_PC);
+        m_HaltBugOperands[1] = bus.Read(static_cast<Address>(m_PC + 1));
+        m_Immediate = m_HaltBugOperands;
+
+        const U8 opcode = m_HaltBugOperands[0];
+        m_Cycles += k_Cycles[opcode];
+        (this->*k_Instructions[opcode])();
+
+        m_Scheduler.Advance(m_Cycles);
+        return m_Cycles;
+    }
 
-            bus->Write(0xFF47, 0xE4);
-            
-            if (++gpuCounter > 70224)
-            {
-                if (auto lcd = m_LCD.lock())
-                {
-                    lcd->Render();
-                }
-                gpuCounter = 0;
-                frame++;
-            }
+    /*PCMEM[0] = bus.Read(m_PC);
+    PCMEM[1] = bus.Read(m_PC + 1);
+    PCMEM[2] = bus.Read(m_PC + 2);
+    PCMEM[3] = bus.Read(m_PC + 3);
 
-            auto TAC = bus->Read(0xFF07);
-            auto TMA = bus->Read(0xFF06);
-            auto TIMA = bus->Read(0xFF05);
+    str = std::format(
+        "A:{:02X} F:{:02X} B:{:02X} C:{:02X} D:{:02X} E:{:02X} H:{:02X} L:{:02X} SP:{:04X} PC:{:04X} PCMEM:{:02X},{:02X},{:02X},{:02X}",
+        Register(Register8::A), Register(Register8::F), Register(Register8::B), Register(Register8::C),
+        Register(Register8::D), Register(Register8::E), Register(Register8::H), Register(Register8::L),
+        Register(Register16::SP), Register(Register16::PC), PCMEM[0], PCMEM[1], PCMEM[2], PCMEM[3]);
+    m_Log << str << '\n';*/
 
-            if (TAC & 0x04)
-            {
-                ++counter;
+    const U8 opcode = Fetch(bus);
+    m_Cycles += k_Cycles[opcode];
+    (this->*k_Instructions[opcode])();
 
-                if ((TAC & 0x03) == 0x03)
-                {
-                    if (counter - lastCounter >= 64)
-                    {
-                        lastCounter = counter;
-                        ++TIMA;
-                        if (TIMA == 0x00)
-                        {
-                            bus->Write(0xFF05, TMA);
-                            bus->Write(0xFF0F, bus->Read(0xFF0F) | 0x04);
-                        }
-                        else
-                        {
-                            bus->Write(0xFF05, TIMA);
-                        }
-                    }
-                }
-                else if ((TAC & 0x03) == 0x02)
-                {
-                    if (counter - lastCounter >= 16)
-                    {
-                        lastCounter = counter;
-                        ++TIMA;
-                        if (TIMA == 0x00)
-                        {
-                            bus->Write(0xFF05, TMA);
-                            bus->Write(0xFF0F, bus->Read(0xFF0F) | 0x04);
-                        }
-                        else
-                        {
-                            bus->Write(0xFF05, TIMA);
-                        }
-                    }
-                }
-                else if ((TAC & 0x03) == 0x01)
-                {
-                    if (counter - lastCounter >= 4)
-                    {
-                        lastCounter = counter;
-                        ++TIMA;
-                        if (TIMA == 0x00)
-                        {
-                            bus->Write(0xFF05, TMA);
-                            bus->Write(0xFF0F, bus->Read(0xFF0F) | 0x04);
-                        }
-                        else
-                        {
-                            bus->Write(0xFF05, TIMA);
-                        }
-                    }
-                }
-                else
-                {
-                    if (counter - lastCounter >= 256)
-                    {
-                        lastCounter = counter;
-                        ++TIMA;
-                        if (TIMA == 0x00)
-                        {
-                            bus->Write(0xFF05, TMA);
-                            bus->Write(0xFF0F, bus->Read(0xFF0F) | 0x04);
-                        }
-                        else
-                        {
-                            bus->Write(0xFF05, TIMA);
-                        }
-                    }
-                }
-            }
+    m_Scheduler.Advance(m_Cycles);
+    return m_Cycles;
+}
 
-            if (m_IME_Next_Cycle)
-            {
-                m_IME = true;
-                m_IME_Next_Cycle = false;
-            }
+void CPU::ServiceInterrupts(Bus& bus)
+{
+    if (m_IME_Next_Cycle)
+    {
+        m_IME = true;
+        m_IME_Next_Cycle = false;
+    }
 
-            if (m_IME)
-            {
-                auto interrupt = bus->Read(0xFF0F) & bus->Read(0xFFFF);
-                if (interrupt != 0x00)
-                {
-                    m_IME = false;
-                    m_IME_Next_Cycle = false;
-                    m_Interrupting = true;
+    if (!m_IME) return;
 
-                    Push(m_PC);
-                    if (interrupt & 0x01)
-                    {
-                        bus->Write(0xFF0F, bus->Read(0xFF0F) & ~0x01);
-                        m_PC = 0x0040;
-                    }
-                    else if (interrupt & 0x02)
-                    {
-                        bus->Write(0xFF0F, bus->Read(0xFF0F) & ~0x02);
-                        m_PC = 0x0048;
-                    }
-                    else if (interrupt & 0x04)
-                    {
-                        bus->Write(0xFF0F, bus->Read(0xFF0F) & ~0x04);
-                        m_PC = 0x0050;
-                    }
-                    else if (interrupt & 0x08)
-                    {
-                        bus->Write(0xFF0F, bus->Read(0xFF0F) & ~0x08);
-                        m_PC = 0x0058;
-                    }
-                    else if (interrupt & 0x10)
-                    {
-                        bus->Write(0xFF0F, bus->Read(0xFF0F) & ~0x10);
-                        m_PC = 0x0060;
-                    }
-                }
-            }
+    const U8 interrupt = bus.InterruptFlags() & bus.InterruptEnable() & 0x1F;
+    if (interrupt == 0x00) return;
 
-            /*PCMEM[0] = bus->Read(m_PC);
-            PCMEM[1] = bus->Read(m_PC + 1);
-            PCMEM[2] = bus->Read(m_PC + 2);
-            PCMEM[3] = bus->Read(m_PC + 3);
+    m_IME = false;
+    m_IME_Next_Cycle = false;
+    m_Interrupting = true;
+    m_Cycles += k_InterruptCycles;
 
-            str = std::format(
-                "A:{:02X} F:{:02X} B:{:02X} C:{:02X} D:{:02X} E:{:02X} H:{:02X} L:{:02X} SP:{:04X} PC:{:04X} PCMEM:{:02X},{:02X},{:02X},{:02X}",
-                Register(Register8::A), Register(Register8::F), Register(Register8::B), Register(Register8::C),
-                Register(Register8::D), Register(Register8::E), Register(Register8::H), Register(Register8::L),
-                Register(Register16::SP), Register(Register16::PC), PCMEM[0], PCMEM[1], PCMEM[2], PCMEM[3]);
-            m_Log << str << '\n';*/
+    // The handler is entered without a block lookup; it must not count as a pass through an idle loop
+    m_IdleLoop.start = 0xFFFF;
 
-            const auto opcode = bus->Read(m_PC++);
-            const auto block = opcode & 0xC0;
-            const auto params = opcode & 0x3F;
+    // The lowest pending bit wins: VBlank 0x40, STAT 0x48, Timer 0x50, Serial 0x58, Joypad 0x60
+    const U8 index = static_cast<U8>(std::countr_zero(interrupt));
+    bus.AcknowledgeInterrupt(static_cast<U8>(1 << index));
 
-#ifdef PRINT_INSTRUCTION
-            std::println(
-                "PC: {:04X} OP: {:02X} A: {:02X} B: {:02X} C: {:02X} D: {:02X} E: {:02X} H: {:02X} L: {:02X} Z: {} N: {} H: {} C: {}",
-                m_PC - 1, opcode, Register(Register8::A), Register(Register8::B), Register(Register8::C),
-                Register(Register8::D), Register(Register8::E), Register(Register8::H), Register(Register8::L),
-                Flag(Flags::Z), Flag(Flags::N), Flag(Flags::H), Flag(Flags::C));
-#endif
+    Push(m_PC);
+    m_PC = static_cast<U16>(0x0040 + index * 8);
+}
 
-            if (bus->Read(0xFF02) == 0x81)
-            {
-                std::print("{}", static_cast<char>(bus->Read(0xFF01)));
-                bus->Write(0xFF02, 0x0);
-            }
+U8 CPU::Fetch(Bus& bus)
+{
+    // Stay inside the current block while execution is sequential, otherwise look up the block at PC
+    if (AtBlockBoundary()) EnterBlock(bus);
 
-            if (opcode == 0xDB)
-            {
-                std::print("\nA: 0x{:02X} ", Register(Register8::A));
-                std::print("B: 0x{:02X} ", Register(Register8::B));
-                std::print("C: 0x{:02X} ", Register(Register8::C));
-                std::print("D: 0x{:02X} ", Register(Register8::D));
-                std::print("E: 0x{:02X} ", Register(Register8::E));
-                std::print("H: 0x{:02X} ", Register(Register8::H));
-                std::print("L: 0x{:02X} ", Register(Register8::L));
-                std::print("HL: 0x{:02X}", Register(Register8::HL));
-
-                std::println("");
-
-                std::print("Z: {}, ", Flag(Flags::Z));
-                std::print("N: {}, ", Flag(Flags::N));
-                std::print("H: {}, ", Flag(Flags::H));
-                std::println("C: {}\n", Flag(Flags::C));
-
-                continue;
-            }
+    const auto& instruction = *m_Cursor++;
+    const U8 opcode = instruction.opcode;
+    m_Immediate = instruction.operands;
+    m_PC++;
 
-            switch (block)
-            {
-            case 0x00:
-                {
-                    switch (params)
-                    {
-                    case 0x00: // nop
 #ifdef PRINT_INSTRUCTION
-                        // std::println("nop");
+    std::println(
+        "PC: {:04X} OP: {:02X} A: {:02X} B: {:02X} C: {:02X} D: {:02X} E: {:02X} H: {:02X} L: {:02X} Z: {} N: {} H: {} C: {}",
+        m_PC - 1, opcode, Register(Register8::A), Register(Register8::B), Register(Register8::C),
+        Register(Register8::D), Register(Register8::E), Register(Register8::H), Register(Register8::L),
+        Flag(Flags::Z), Flag(Flags::N), Flag(Flags::H), Flag(Flags::C));
 #endif
-                        break;
-                    case 0x07:
-                        RotateLeftCarryAccumulator(); // rlca
-                        break;
-                    case 0x08:
-                        LoadFromStackPointer(); // ld [imm16], sp
-                        break;
-                    case 0x0F:
-                        RotateRightCarryAccumulator(); // rrca
-                        break;
-                    case 0x10:
-                        Stop(); // stop
-                        break;
-                    case 0x17:
-                        RotateLeftAccumulator(); // rla
-                        break;
-                    case 0x18:
-                        JumpRelative(); // jr imm8
-                        break;
-                    case 0x1F:
-                        RotateRightAccumulator(); // rra
-                        break;
-                    case 0x27:
-                        DecimalAdjustAccumulator(); // daa 
-                        break;
-                    case 0x2F:
-                        ComplementAccumulator(); // cpl
-                        break;
-                    case 0x37:
-                        SetCarryFlag(); // scf
-                        break;
-                    case 0x3F:
-                        ComplementCarryFlag(); // ccf
-                        break;
-                    default:
-                        U8 reg = (params & 0x30) >> 4;
-                        U8 rightParam = params & 0x0F;
-
-                        if (rightParam == 0x1) // ld r16, imm16
-                        {
-                            LoadImm16ToR16(m_R16[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0x2) // ld [r16mem], a
-                        {
-                            LoadAccumulatorToR16Address(m_R16mem[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0x3) // inc r16
-                        {
-                            Increment(m_R16[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0x9) // add hl, r16
-                        {
-                            Add(m_R16[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0xA) // ld a, [r16mem]
-                        {
-                            LoadR16AddressToAccumulator(m_R16mem[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0xB) // dec r16
-                        {
-                            Decrement(m_R16[reg]);
-                            break;
-                        }
 
-                        reg = (params & 0x38) >> 3;
-                        rightParam = params & 0x07;
+    return opcode;
+}
 
-                        if (rightParam == 0x4) // inc r8
-                        {
-                            Increment(m_R8[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0x5) // dec r8
-                        {
-                            Decrement(m_R8[reg]);
-                            break;
-                        }
-                        else if (rightParam == 0x6) // ld r8, imm8
-                        {
-                            LoadImm8ToR8(m_R8[reg]);
-                            break;
-                        }
+bool CPU::AtBlockBoundary() const
+{
+    return m_BlockGeneration != m_BlockCache.Generation() || m_Cursor == m_BlockEnd || m_Cursor->address != m_PC;
+}
 
-                        if ((params & 0x20) == 0x20 && rightParam == 0x0) // jr cond, imm8
-                        {
-                            JumpRelativeConditional((params >> 3) & 0x03);
-                            break;
-                        }
-                    }
-                    break;
-                }
-            case 0x40: // Block 1: 8-bit Register-To-Register loads
-                {
-                    if (params == 0x36)
-                    {
-                        std::print("halt\n");
-                    }
-                    else
-                    {
-                        const U8 dest = (params >> 3) & 0x07;
-                        const U8 src = params & 0x07;
-                        LoadR8ToR8(m_R8[dest], m_R8[src]); // ld r8, r8
-                    }
-                    break;
-                }
-            case 0x80:
-                {
-                    const Register8 operand = m_R8[params & 0x07];
-                    switch ((params & 0x38) >> 3)
-                    {
-                    case 0x0:
-                        Add(operand); // add a, r8
-                        break;
-                    case 0x1:
-                        Adc(operand); // adc a, r8
-                        break;
-                    case 0x2:
-                        Sub(operand); // sub a, r8
-                        break;
-                    case 0x3:
-                        Sbc(operand); // sbc a, r8
-                        break;
-                    case 0x4:
-                        And(operand); // and a, r8
-                        break;
-                    case 0x5:
-                        Xor(operand); // xor a, r8
-                        break;
-                    case 0x6:
-                        Or(operand); // or a, r8
-                        break;
-                    case 0x7:
-                        Cp(operand); // cp a, r8
-                        break;
-                    }
-                    break;
-                }
-            case 0xC0:
-                {
-                    switch (params)
-                    {
-                    case 0x03:
-                        Jump(Register16::Imm16);
-                        break;
-                    case 0x06:
-                        Add(Register8::Imm8);
-                        break;
-                    case 0x09:
-                        Return();
-                        break;
-                    case 0x0B:
-                        {
-                            const U8 suffix = bus->Read(m_PC++);
-                            const U8 suffixBlock = (suffix & 0xC0) >> 6;
-                            const U8 operand = suffix & 0x7;
-                            const U8 bitIndex = (suffix & 0x38) >> 3;
-
-                            switch (suffixBlock)
-                            {
-                            case 0x0:
-                                switch (bitIndex)
-                                {
-                                case 0x0:
-                                    RotateLeftCarry(m_R8[operand]);
-                                    break;
-                                case 0x1:
-                                    RotateRightCarry(m_R8[operand]);
-                                    break;
-                                case 0x2:
-                                    RotateLeft(m_R8[operand]);
-                                    break;
-                                case 0x3:
-                                    RotateRight(m_R8[operand]);
-                                    break;
-                                case 0x4:
-                                    ShiftLeft(m_R8[operand]);
-                                    break;
-                                case 0x5:
-                                    ShiftRight(m_R8[operand]);
-                                    break;
-                                case 0x6:
-                                    Swap(m_R8[operand]);
-                                    break;
-                                case 0x7:
-                                    ShiftRightLogically(m_R8[operand]);
-                                    break;
-                                }
-                                break;
-                            case 0x1:
-                                Bit(bitIndex, m_R8[operand]);
-                                break;
-                            case 0x2:
-                                Reset(bitIndex, m_R8[operand]);
-                                break;
-                            case 0x3:
-                                Set(bitIndex, m_R8[operand]);
-                                break;
-                            }
-                            break;
-                        }
-                    case 0x0D:
-                        Call();
-                        break;
-                    case 0x0E:
-                        Adc(Register8::Imm8);
-                        break;
-                    case 0x16:
-                        Sub(Register8::Imm8);
-                        break;
-                    case 0x19:
-                        ReturnI();
-                        break;
-                    case 0x1E:
-                        Sbc(Register8::Imm8);
-                        break;
-                    case 0x20:
-                        LoadHighFromAccumulator(Register8::Imm8);
-                        break;
-                    case 0x22:
-                        LoadHighFromAccumulator(Register8::C);
-                        break;
-                    case 0x26:
-                        And(Register8::Imm8);
-                        break;
-                    case 0x28:
-                        AddSP();
-                        break;
-                    case 0x29:
-                        Jump(Register16::HL);
-                        break;
-                    case 0x2A:
-                        LoadAccumulatorToR16Address(Register16::Imm16);
-                        break;
-                    case 0x2E:
-                        Xor(Register8::Imm8);
-                        break;
-                    case 0x30:
-                        LoadHighToAccumulator(Register8::Imm8);
-                        break;
-                    case 0x32:
-                        LoadHighToAccumulator(Register8::C);
-                        break;
-                    case 0x33:
-                        DisableInterrupts();
-                        break;
-                    case 0x36:
-                        Or(Register8::Imm8);
-                        break;
-                    case 0x38:
-                        LoadSPOffsetToHL();
-                        break;
-                    case 0x39:
-                        LoadHLToSP();
-                        break;
-                    case 0x3A:
-                        LoadR16AddressToAccumulator(Register16::Imm16);
-                        break;
-                    case 0x3B:
-                        EnableInterrupts();
-                        break;
-                    case 0x3E:
-                        Cp(Register8::Imm8);
-                        break;
-                    default:
-                        const U8 right = params & 0x07;
-                        const U8 cond = (params & 0x18) >> 3;
-                        const U8 tgt3 = (params & 0x38) >> 3;
-                        const Register16 rstk = m_R16stk[(params & 0x30) >> 4];
-
-                        switch (right)
-                        {
-                        case 0x0:
-                            ReturnConditional(cond);
-                            break;
-                        case 0x1:
-                            Pop(rstk);
-                            break;
-                        case 0x2:
-                            JumpConditional(cond);
-                            break;
-                        case 0x4:
-                            CallConditional(cond);
-                            break;
-                        case 0x5:
-                            Push(rstk);
-                            break;
-                        case 0x7:
-                            Restart(tgt3);
-                            break;
-                        }
-                    }
-                    break;
-                }
-            }
+BlockCache::Block& CPU::EnterBlock(Bus& bus)
+{
+    auto& block = m_BlockCache.Lookup(bus, m_PC);
+    m_Cursor = block.instructions.data();
+    m_BlockEnd = m_Cursor + block.instructions.size();
+    m_BlockGeneration = m_BlockCache.Generation();
+    return block;
+}
 
-            // std::this_thread::sleep_for(std::chrono::milliseconds(20));
-        }
-    }
-    else
+bool CPU::SkipIdleLoop(const BlockCache::Block& block, U64 end)
+{
+    const U64 now = m_Scheduler.Now();
+    auto& last = m_IdleLoop;
+
+    // Every block entry is seen here, so a matching record means the previous pass ran this block alone.
+    // No event fired during it, so memory is unchanged too: the loop writes nothing and everything
+    // else that could change it (timer, LY, serial, interrupt requests) is a scheduled event. The only
+    // register computed from the clock when read (DIV) is the exception, a loop reading it never repeats.
+    const bool repeating = block.idleLoop && last.start == block.start && last.timestamp < now && now < last.deadline &&
+        last.volatileReads == m_Bus.VolatileReads() &&
+        last.registers.A == m_Registers.A && last.flags == PackFlags() && last.registers.BC == m_Registers.BC &&
+        last.registers.DE == m_Registers.DE && last.registers.HL == m_Registers.HL &&
+        last.sp == m_SP && !m_IME_Next_Cycle;
+
+    if (repeating)
     {
-        std::cerr << "Bus is not available!";
-        exit(1);
+        // Whole passes only, up to the next event: the loop head is then reached in the same state
+        const U64 period = now - last.timestamp;
+        const U64 limit = std::min({ m_Scheduler.NextDeadline(), end, now + k_MaxHaltSkip });
+        const U64 passes = limit > now ? (limit - now) / period : 0;
+
+        if (passes > 0)
+        {
+            m_Cycles = static_cast<U32>(passes * period);
+            m_Scheduler.Advance(m_Cycles);
+
+            last.timestamp = m_Scheduler.Now();
+            last.deadline = m_Scheduler.NextDeadline();
+            return true;
+        }
     }
-}
 
-void CPU::Step(U16 address)
-{
-    m_PC = address;
-    Step();
+    last.start = block.idleLoop ? block.start : 0xFFFF;
+    last.registers = m_Registers;
+    last.flags = PackFlags();
+    last.sp = m_SP;
+    last.timestamp = now;
+    last.deadline = m_Scheduler.NextDeadline();
+    last.volatileReads = m_Bus.VolatileReads();
+    return false;
 }
 
 template <class... Types>
@@ -1087,326 +818,283 @@ void CPU::LoadFromStackPointer()
 {
     U16 address = ReadImm16();
 
-    PrintInstruction("ld {:04X}, sp[{:04X}]", address, Register(Register16::SP));
+    PrintInstruction("ld {:04X}, sp[{:04X}]", address, m_SP);
 
-    if (const auto bus = m_Bus.lock())
-    {
-        bus->Write(address++, static_cast<U8>(Register(Register16::SP) & 0xFF));
-        bus->Write(address, static_cast<U8>(Register(Register16::SP) >> 8));
-    }
+    m_Bus.Write(address++, static_cast<U8>(m_SP & 0xFF));
+    m_Bus.Write(address, static_cast<U8>(m_SP >> 8));
 }
 
-void CPU::LoadImm16ToR16(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::LoadImm16ToR16()
 {
     const U16 data = ReadImm16();
     PrintInstruction("ld {}, imm16", RegisterLiteral(reg), data);
-    Register(reg, data);
+    Register<reg>(data);
 }
 
-void CPU::LoadAccumulatorToR16Address(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::LoadAccumulatorToR16Address()
 {
     PrintInstruction("ld [{}], a", RegisterLiteral(reg));
 
-    if (const auto bus = m_Bus.lock())
-    {
-        const U8 data = Register(Register8::A);
-        const Address address = Register(reg);
-        bus->Write(address, data);
+    const U8 data = m_Registers.A;
+    const Address address = Register<reg>();
+    m_Bus.Write(address, data);
 
-        if (reg == Register16::HLd)
-        {
-            if (address == 0x0000)
-            {
-                Register(Register16::HL, 0xFFFF);
-            }
-            else
-            {
-                Register(Register16::HL, address - 1);
-            }
-        }
-        else if (reg == Register16::HLi)
-        {
-            if (address == 0xFFFF)
-            {
-                Register(Register16::HL, 0x0000);
-            }
-            else
-            {
-                Register(Register16::HL, address + 1);
-            }
-        }
-    }
+    if constexpr (reg == Register16::HLd) m_Registers.HL = address - 1;
+    else if constexpr (reg == Register16::HLi) m_Registers.HL = address + 1;
 }
 
-void CPU::LoadR16AddressToAccumulator(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::LoadR16AddressToAccumulator()
 {
     PrintInstruction("ld a, {}", RegisterLiteral(reg));
 
-    if (const auto bus = m_Bus.lock())
-    {
-        const Address address = Register(reg);
-        const U8 data = bus->Read(address);
-        Register(Register8::A, data);
+    const Address address = Register<reg>();
+    const U8 data = m_Bus.Read(address);
+    m_Registers.A = data;
 
-        if (address == 0xFF0F)
-        {
-            std::println("Address: {:04X} -> {:02X}", address, data);
-        }
-
-        if (reg == Register16::HLd)
-        {
-            if (Register(Register16::HL) == 0x0000)
-            {
-                Register(Register16::HL, 0xFFFF);
-            }
-            else
-            {
-                Register(Register16::HL, Register(Register16::HL) - 1);
-            }
-        }
-        else if (reg == Register16::HLi)
-        {
-            if (Register(Register16::HL) == 0xFFFF)
-            {
-                Register(Register16::HL, 0x0000);
-            }
-            else
-            {
-                Register(Register16::HL, Register(Register16::HL) + 1);
-            }
-        }
+    if (address == 0xFF0F)
+    {
+        std::println("Address: {:04X} -> {:02X}", address, data);
     }
+
+    if constexpr (reg == Register16::HLd) m_Registers.HL--;
+    else if constexpr (reg == Register16::HLi) m_Registers.HL++;
 }
 
 void CPU::LoadSPOffsetToHL()
 {
     PrintInstruction("ld hl, sp + imm8");
 
-    const U16 sp = Register(Register16::SP);
+    const U16 sp = m_SP;
     const S8 imm8 = static_cast<S8>(ReadImm8());
 
     const U16 result = static_cast<U16>(sp + imm8);
-    Register(Register16::HL, result);
+    m_Registers.HL = result;
 
-    Flag(Flags::Z, false);
-    Flag(Flags::N, false);
-    Flag(Flags::H, ((sp & 0x0F) + (imm8 & 0x0F)) > 0x0F);
-    Flag(Flags::C, ((sp & 0xFF) + (imm8 & 0xFF)) > 0xFF);
+    // Flags come from the unsigned add of the low bytes
+    m_Flags.zero = 0x01;
+    m_Flags.subtract = false;
+    m_Flags.half = static_cast<U8>(sp ^ imm8 ^ result);
+    m_Flags.carry = static_cast<U16>((sp & 0xFF) + static_cast<U8>(imm8));
 }
 
 void CPU::LoadHLToSP()
 {
     PrintInstruction("ld sp, hl");
 
-    m_SP = Register(Register16::HL);
+    m_SP = m_Registers.HL;
 }
 
 #pragma endregion
 
 #pragma region 8-bit Load Instructions
 
-void CPU::LoadImm8ToR8(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::LoadImm8ToR8()
 {
     const U8 data = ReadImm8();
 
     PrintInstruction("ld r8, {:02X}", data);
 
-    Register(reg, data);
+    Register<reg>(data);
 }
 
-void CPU::LoadR8ToR8(Register8 left, Register8 right)
+template <CPU::Register8 left, CPU::Register8 right>
+void CPU::LoadR8ToR8()
 {
     PrintInstruction("ld {}, {}", RegisterLiteral(left), RegisterLiteral(right));
 
-    if (const auto bus = m_Bus.lock())
-    {
-        Register(left, Register(right));
-    }
+    Register<left>(Register<right>());
 }
 
-void CPU::LoadHighToAccumulator(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::LoadHighToAccumulator()
 {
     PrintInstruction("ldh a, [{}]", RegisterLiteral(reg));
 
-    if (const auto bus = m_Bus.lock())
-    {
-        const Address address = 0xFF00 + Register(reg);
-        Register(Register8::A, bus->Read(address));
-    }
+    const Address address = 0xFF00 + Register<reg>();
+    m_Registers.A = m_Bus.Read(address);
 }
 
-void CPU::LoadHighFromAccumulator(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::LoadHighFromAccumulator()
 {
     PrintInstruction("ldh [{}], a", RegisterLiteral(reg));
 
-    if (const auto bus = m_Bus.lock())
-    {
-        const Address address = 0xFF00 + Register(reg);
-        bus->Write(address, Register(Register8::A));
-    }
+    const Address address = 0xFF00 + Register<reg>();
+    m_Bus.Write(address, m_Registers.A);
 }
 
 #pragma endregion
 
 #pragma region 8-bit Arithmetic & Logical Instructions
 
-void CPU::Add(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Add()
 {
     PrintInstruction("add a, {}", RegisterLiteral(reg));
 
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
+    const U8 accumulator = m_Registers.A;
+    const U8 value = Register<reg>();
     const U16 result = accumulator + value;
 
-    Register(Register8::A, static_cast<U8>(result));
+    m_Registers.A = static_cast<U8>(result);
 
-    Flag(Flags::Z, static_cast<U8>(result) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, (accumulator & 0x0F) + (value & 0x0F) > 0x0F);
-    Flag(Flags::C, result > 0xFF);
+    m_Flags.zero = static_cast<U8>(result);
+    m_Flags.subtract = false;
+    m_Flags.half = static_cast<U8>(accumulator ^ value ^ result);
+    m_Flags.carry = result;
 }
 
-void CPU::Adc(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Adc()
 {
     PrintInstruction("adc a, {}", RegisterLiteral(reg));
 
     const bool carry = Flag(Flags::C);
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
+    const U8 accumulator = m_Registers.A;
+    const U8 value = Register<reg>();
     const U16 result = accumulator + value + carry;
 
-    Register(Register8::A, static_cast<U8>(result));
+    m_Registers.A = static_cast<U8>(result);
 
-    Flag(Flags::Z, static_cast<U8>(result) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, ((accumulator & 0x0F) + (value & 0x0F) + carry) > 0x0F);
-    Flag(Flags::C, result > 0xFF);
+    m_Flags.zero = static_cast<U8>(result);
+    m_Flags.subtract = false;
+    m_Flags.half = static_cast<U8>(accumulator ^ value ^ result);
+    m_Flags.carry = result;
 }
 
-void CPU::Sub(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Sub()
 {
     PrintInstruction("sub a, {}", RegisterLiteral(reg));
 
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
+    const U8 accumulator = m_Registers.A;
+    const U8 value = Register<reg>();
     const U16 result = accumulator - value;
 
-    Register(Register8::A, static_cast<U8>(result));
+    m_Registers.A = static_cast<U8>(result);
 
-    Flag(Flags::Z, static_cast<U8>(result) == 0x00);
-    Flag(Flags::N, true);
-    Flag(Flags::H, (accumulator & 0x0F) < (value & 0x0F));
-    Flag(Flags::C, accumulator < value);
+    // The 16-bit difference wraps, so bit 8 is the borrow
+    m_Flags.zero = static_cast<U8>(result);
+    m_Flags.subtract = true;
+    m_Flags.half = static_cast<U8>(accumulator ^ value ^ result);
+    m_Flags.carry = result;
 }
 
-void CPU::Sbc(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Sbc()
 {
     PrintInstruction("sbc a, {}", RegisterLiteral(reg));
 
     const bool carry = Flag(Flags::C);
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
+    const U8 accumulator = m_Registers.A;
+    const U8 value = Register<reg>();
     const U16 result = accumulator - value - carry;
 
-    Register(Register8::A, static_cast<U8>(result));
+    m_Registers.A = static_cast<U8>(result);
 
-    Flag(Flags::Z, static_cast<U8>(result) == 0x00);
-    Flag(Flags::N, true);
-    Flag(Flags::H, (accumulator & 0x0F) < ((value & 0x0F) + carry));
-    Flag(Flags::C, accumulator < (value + carry));
+    m_Flags.zero = static_cast<U8>(result);
+    m_Flags.subtract = true;
+    m_Flags.half = static_cast<U8>(accumulator ^ value ^ result);
+    m_Flags.carry = result;
 }
 
-void CPU::And(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::And()
 {
     PrintInstruction("and a, {}", RegisterLiteral(reg));
 
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
-    const U8 result = accumulator & value;
+    const U8 result = m_Registers.A & Register<reg>();
 
-    Register(Register8::A, static_cast<U8>(result));
+    m_Registers.A = result;
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, true);
-    Flag(Flags::C, false);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x10;
+    m_Flags.carry = 0x000;
 }
 
-void CPU::Xor(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Xor()
 {
     PrintInstruction("xor a, {}", RegisterLiteral(reg));
 
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
-    const U8 result = accumulator ^ value;
+    const U8 result = m_Registers.A ^ Register<reg>();
 
-    Register(Register8::A, result);
+    m_Registers.A = result;
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, false);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = 0x000;
 }
 
-void CPU::Or(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Or()
 {
     PrintInstruction("or a, {}", RegisterLiteral(reg));
 
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
-    const U8 result = accumulator | value;
+    const U8 result = m_Registers.A | Register<reg>();
 
-    Register(Register8::A, result);
+    m_Registers.A = result;
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, false);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = 0x000;
 }
 
-void CPU::Cp(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Cp()
 {
-    PrintInstruction("cp a, r8");
+    PrintInstruction("cp a, {}", RegisterLiteral(reg));
 
-    const U8 accumulator = Register(Register8::A);
-    const U8 value = Register(reg);
-    const U8 result = accumulator - value;
+    const U8 accumulator = m_Registers.A;
+    const U8 value = Register<reg>();
+    const U16 result = accumulator - value;
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, true);
-    Flag(Flags::H, (accumulator & 0x0F) < (value & 0x0F));
-    Flag(Flags::C, accumulator < value);
+    m_Flags.zero = static_cast<U8>(result);
+    m_Flags.subtract = true;
+    m_Flags.half = static_cast<U8>(accumulator ^ value ^ result);
+    m_Flags.carry = result;
 }
 
-void CPU::Increment(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Increment()
 {
-    const U8 value = Register(reg);
-    Register(reg, value + 1);
+    const U8 value = Register<reg>();
+    const U8 result = value + 1;
+    Register<reg>(result);
 
     PrintInstruction("inc {}({:02X})", RegisterLiteral(reg), value);
 
-    Flag(Flags::Z, Register(reg) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, (value & 0xF) == 0xF);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = value ^ result;
 }
 
-void CPU::Decrement(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Decrement()
 {
-    PrintInstruction("dec r8");
+    PrintInstruction("dec {}", RegisterLiteral(reg));
 
-    const U8 value = Register(reg);
-    Register(reg, value - 1);
+    const U8 value = Register<reg>();
+    const U8 result = value - 1;
+    Register<reg>(result);
 
-    Flag(Flags::Z, Register(reg) == 0x00);
-    Flag(Flags::N, true);
-    Flag(Flags::H, (value & 0x0F) == 0x0);
+    m_Flags.zero = result;
+    m_Flags.subtract = true;
+    m_Flags.half = value ^ result;
 }
 
 void CPU::DecimalAdjustAccumulator()
 {
     PrintInstruction("daa");
 
-    U8 accumulator = Register(Register8::A);
+    U8 accumulator = m_Registers.A;
     bool carry = Flag(Flags::C);
     bool sub = Flag(Flags::N);
 
@@ -1415,83 +1103,101 @@ void CPU::DecimalAdjustAccumulator()
     if (Flag(Flags::H) || (lsn > 9 && !sub)) correction = 0x06;
 
     carry = carry || (((accumulator & 0xF0) > 0x90 && correction == 0x06) && !sub);
-    accumulator += Flag(Flags::N) ? -correction : correction;
+    accumulator += sub ? -correction : correction;
     correction = 0;
 
     const U8 msn = accumulator >> 4;
     if (carry || (msn > 0x9 && !sub)) correction = 0x60;
     carry = carry || correction == 0x60;
 
-    accumulator += Flag(Flags::N) ? -correction : correction;
-    Register(Register8::A, accumulator);
+    accumulator += sub ? -correction : correction;
+    m_Registers.A = accumulator;
 
-    Flag(Flags::Z, accumulator == 0x00);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = accumulator;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
 void CPU::ComplementAccumulator()
 {
     PrintInstruction("cpl");
 
-    Register(Register8::A, ~Register(Register8::A));
+    m_Registers.A = ~m_Registers.A;
 
-    Flag(Flags::N, true);
-    Flag(Flags::H, true);
+    m_Flags.subtract = true;
+    m_Flags.half = 0x10;
 }
 
 void CPU::SetCarryFlag()
 {
     PrintInstruction("scf");
 
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, true);
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = 0x100;
 }
 
 void CPU::ComplementCarryFlag()
 {
     PrintInstruction("ccf");
 
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, !Flag(Flags::C));
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry ^= 0x100;
 }
 
 #pragma endregion
 
 #pragma region 16-bit Arithmetic
 
-void CPU::Add(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::Add()
 {
-    PrintInstruction("add hl, r16");
+    PrintInstruction("add hl, {}", RegisterLiteral(reg));
 
-    const U16 hl = Register(Register16::HL);
-    const U16 value = Register(reg);
-    const U16 half = (hl & 0x0FFF) + (value & 0x0FFF);
+    const U16 hl = m_Registers.HL;
+    const U16 value = Register<reg>();
     const U32 result = hl + value;
 
-    Register(Register16::HL, static_cast<U16>(result));
+    m_Registers.HL = static_cast<U16>(result);
 
-    Flag(Flags::N, false);
-    Flag(Flags::H, half > 0x0FFF);
-    Flag(Flags::C, result > 0xFFFF);
+    // Carries out of bits 11 and 15, shifted down onto the 8-bit positions
+    m_Flags.subtract = false;
+    m_Flags.half = static_cast<U8>((hl ^ value ^ result) >> 8);
+    m_Flags.carry = static_cast<U16>(result >> 8);
 }
 
-void CPU::Increment(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::Increment()
 {
-    PrintInstruction("inc r16");
+    PrintInstruction("inc {}", RegisterLiteral(reg));
 
-    Register(reg, Register(reg) + 1);
+    Register<reg>(Register<reg>() + 1);
 }
 
-void CPU::Decrement(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::Decrement()
 {
-    PrintInstruction("dec r16");
+    PrintInstruction("dec {}", RegisterLiteral(reg));
 
-    Register(reg, Register(reg) - 1);
+    Register<reg>(Register<reg>() - 1);
 }
 
+void CPU::AddSP()
+{
+    PrintInstruction("add sp, imm8");
+
+    const S8 imm8 = static_cast<S8>(ReadImm8());
+    const U16 sp = m_SP;
+    const U16 result = static_cast<U16>(sp + imm8);
+    m_SP = result;
+
+    // Flags come from the unsigned add of the low bytes
+    m_Flags.zero = 0x01;
+    m_Flags.subtract = false;
+    m_Flags.half = static_cast<U8>(sp ^ imm8 ^ result);
+    m_Flags.carry = static_cast<U16>((sp & 0xFF) + static_cast<U8>(imm8));
+}
 
 #pragma endregion
 
@@ -1501,166 +1207,181 @@ void CPU::RotateLeftCarryAccumulator()
 {
     PrintInstruction("rlca");
 
-    const bool carry = Register(Register8::A) & 0x80;
-    Register(Register8::A, static_cast<U8>((Register(Register8::A) << 1) | static_cast<U8>(carry)));
+    const bool carry = m_Registers.A & 0x80;
+    m_Registers.A = static_cast<U8>((m_Registers.A << 1) | static_cast<U8>(carry));
 
-    Flag(Flags::Z, false);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = 0x01;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
 void CPU::RotateRightCarryAccumulator()
 {
     PrintInstruction("rrca");
 
-    const bool carry = Register(Register8::A) & 0x01;
-    Register(Register8::A, static_cast<U8>((Register(Register8::A) >> 1) | (carry ? 0x80 : 0x00)));
+    const bool carry = m_Registers.A & 0x01;
+    m_Registers.A = static_cast<U8>((m_Registers.A >> 1) | (carry ? 0x80 : 0x00));
 
-    Flag(Flags::Z, false);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = 0x01;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
 void CPU::RotateLeftAccumulator()
 {
     PrintInstruction("rla");
 
-    const bool carry = Register(Register8::A) & 0x80;
+    const bool carry = m_Registers.A & 0x80;
 
-    Register(Register8::A, static_cast<U8>((Register(Register8::A) << 1) | static_cast<U8>(Flag(Flags::C))));
+    m_Registers.A = static_cast<U8>((m_Registers.A << 1) | static_cast<U8>(Flag(Flags::C)));
 
-    Flag(Flags::Z, false);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = 0x01;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
 void CPU::RotateRightAccumulator()
 {
     PrintInstruction("rra");
 
-    const bool carry = Register(Register8::A) & 0x01;
+    const bool carry = m_Registers.A & 0x01;
 
-    Register(Register8::A, static_cast<U8>((Register(Register8::A) >> 1) | (Flag(Flags::C) ? 0x80 : 0x00)));
+    m_Registers.A = static_cast<U8>((m_Registers.A >> 1) | (Flag(Flags::C) ? 0x80 : 0x00));
 
-    Flag(Flags::Z, false);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = 0x01;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::RotateLeftCarry(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::RotateLeftCarry()
 {
-    PrintInstruction("rlc r8");
+    PrintInstruction("rlc {}", RegisterLiteral(reg));
 
-    const bool carry = Register(reg) & 0x80;
-    const U8 result = static_cast<U8>(Register(reg) << 1) | static_cast<U8>(carry);
-    Register(reg, result);
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x80;
+    const U8 result = static_cast<U8>(value << 1) | static_cast<U8>(carry);
+    Register<reg>(result);
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::RotateRightCarry(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::RotateRightCarry()
 {
-    PrintInstruction("rrc r8");
+    PrintInstruction("rrc {}", RegisterLiteral(reg));
 
-    const bool carry = Register(reg) & 0x01;
-    const U8 result = static_cast<U8>(Register(reg) >> 1) | (carry ? 0x80 : 0x00);
-    Register(reg, result);
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x01;
+    const U8 result = static_cast<U8>(value >> 1) | (carry ? 0x80 : 0x00);
+    Register<reg>(result);
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::RotateLeft(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::RotateLeft()
 {
-    PrintInstruction("rl r8");
+    PrintInstruction("rl {}", RegisterLiteral(reg));
 
-    const bool carry = Register(reg) & 0x80;
-    const U8 result = static_cast<U8>(Register(reg) << 1) | Flag(Flags::C);
-    Register(reg, result);
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x80;
+    const U8 result = static_cast<U8>(value << 1) | Flag(Flags::C);
+    Register<reg>(result);
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::RotateRight(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::RotateRight()
 {
-    PrintInstruction("rr r8");
+    PrintInstruction("rr {}", RegisterLiteral(reg));
 
-    const bool carry = Register(reg) & 0x01;
-    const U8 result = static_cast<U8>(Register(reg) >> 1) | (Flag(Flags::C) ? 0x80 : 0x00);
-    Register(reg, result);
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x01;
+    const U8 result = static_cast<U8>(value >> 1) | (Flag(Flags::C) ? 0x80 : 0x00);
+    Register<reg>(result);
 
-    Flag(Flags::Z, result == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::ShiftLeft(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::ShiftLeft()
 {
-    PrintInstruction("sla r8");
+    PrintInstruction("sla {}", RegisterLiteral(reg));
 
-    const bool carry = Register(reg) & 0x80;
-    Register(reg, static_cast<U8>(Register(reg) << 1));
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x80;
+    const U8 result = static_cast<U8>(value << 1);
+    Register<reg>(result);
 
-    Flag(Flags::Z, Register(reg) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::ShiftRight(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::ShiftRight()
 {
-    PrintInstruction("sra r8");
+    PrintInstruction("sra {}", RegisterLiteral(reg));
 
-    const bool bit7 = Register(reg) & 0x80;
-    const bool carry = Register(reg) & 0x01;
-    Register(reg, static_cast<U8>(Register(reg) >> 1) | (bit7 ? 0x80 : 0x00));
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x01;
+    const U8 result = static_cast<U8>(value >> 1) | (value & 0x80);
+    Register<reg>(result);
 
-    Flag(Flags::Z, Register(reg) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-void CPU::ShiftRightLogically(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::ShiftRightLogically()
 {
-    PrintInstruction("srl r8");
+    PrintInstruction("srl {}", RegisterLiteral(reg));
 
-    const bool carry = Register(reg) & 0x01;
-    Register(reg, static_cast<U8>(Register(reg) >> 1));
+    const U8 value = Register<reg>();
+    const bool carry = value & 0x01;
+    const U8 result = static_cast<U8>(value >> 1);
+    Register<reg>(result);
 
-    Flag(Flags::Z, Register(reg) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, carry);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = carry ? 0x100 : 0x000;
 }
 
-
-void CPU::Swap(Register8 reg)
+template <CPU::Register8 reg>
+void CPU::Swap()
 {
-    PrintInstruction("swap r8");
+    PrintInstruction("swap {}", RegisterLiteral(reg));
 
-    const U8 lsn = Register(reg) & 0x0F;
-    const U8 hsn = Register(reg) & 0xF0;
+    const U8 value = Register<reg>();
+    const U8 result = static_cast<U8>(value << 4) | static_cast<U8>(value >> 4);
+    Register<reg>(result);
 
-    Register(reg, static_cast<U8>(lsn << 4) | static_cast<U8>(hsn >> 4));
-
-    Flag(Flags::Z, Register(reg) == 0x00);
-    Flag(Flags::N, false);
-    Flag(Flags::H, false);
-    Flag(Flags::C, false);
+    m_Flags.zero = result;
+    m_Flags.subtract = false;
+    m_Flags.half = 0x00;
+    m_Flags.carry = 0x000;
 }
 
 #pragma endregion
@@ -1676,33 +1397,38 @@ void CPU::Call()
     m_PC = address;
 }
 
-void CPU::CallConditional(U8 cond)
+template <U8 cond>
+void CPU::CallConditional()
 {
-    PrintInstruction("call cond, imm16");
+    PrintInstruction("call {}, imm16", ConditionLiteral(cond));
 
     const Address address = ReadImm16();
-    if (Condition(cond))
+    if (Condition<cond>())
     {
         Push(m_PC);
         m_PC = address;
+        m_Cycles += k_CallTakenCycles;
     }
 }
 
-void CPU::Jump(Register16 reg)
+template <CPU::Register16 reg>
+void CPU::Jump()
 {
-    const Address address = Register(reg);
+    const Address address = Register<reg>();
     PrintInstruction("jp 0x{:04X}", address);
     m_PC = address;
 }
 
-void CPU::JumpConditional(U8 cond)
+template <U8 cond>
+void CPU::JumpConditional()
 {
-    PrintInstruction("jp cond, imm16");
+    PrintInstruction("jp {}, imm16", ConditionLiteral(cond));
 
     const Address address = ReadImm16();
-    if (Condition(cond))
+    if (Condition<cond>())
     {
         m_PC = address;
+        m_Cycles += k_JumpTakenCycles;
     }
 }
 
@@ -1714,11 +1440,16 @@ void CPU::JumpRelative()
     m_PC += offset;
 }
 
-void CPU::JumpRelativeConditional(U8 cond)
+template <U8 cond>
+void CPU::JumpRelativeConditional()
 {
     const S8 offset = static_cast<S8>(ReadImm8());
     PrintInstruction("jr {}, {}({:02X})", ConditionLiteral(cond), offset, static_cast<U8>(offset));
-    if (Condition(cond)) m_PC += offset;
+    if (Condition<cond>())
+    {
+        m_PC += offset;
+        m_Cycles += k_JumpTakenCycles;
+    }
 }
 
 void CPU::Return()
@@ -1741,21 +1472,23 @@ void CPU::ReturnI()
     m_IME = true;
 }
 
-void CPU::ReturnConditional(U8 cond)
+template <U8 cond>
+void CPU::ReturnConditional()
 {
-    PrintInstruction("ret cond");
+    PrintInstruction("ret {}", ConditionLiteral(cond));
 
-    if (Condition(cond))
+    if (Condition<cond>())
     {
         const Address address = Pop16();
         m_PC = address;
+        m_Cycles += k_ReturnTakenCycles;
     }
 }
 
-
-void CPU::Restart(U8 vec)
+template <U8 vec>
+void CPU::Restart()
 {
-    PrintInstruction("rst vec");
+    PrintInstruction("rst {:02X}", vec << 3);
 
     Push(m_PC);
     m_PC = static_cast<U16>(vec << 3);
@@ -1771,6 +1504,17 @@ void CPU::Stop() const
     system("pause");
 }
 
+void CPU::Halt()
+{
+    PrintInstruction("halt");
+
+    const bool pending = (m_Bus.InterruptFlags() & m_Bus.InterruptEnable() & 0x1F) != 0;
+
+    // With IME off and an interrupt already pending the CPU does not halt, it trips the halt bug
+    if (pending && !m_IME && !m_IME_Next_Cycle) m_HaltBug = true;
+    else if (!pending) m_Halted = true;
+}
+
 void CPU::DisableInterrupts()
 {
     PrintInstruction("di");
@@ -1786,42 +1530,401 @@ void CPU::EnableInterrupts()
     m_Wait = 2;
 }
 
-void CPU::AddSP()
+void CPU::Prefix()
 {
-    PrintInstruction("add sp, imm8");
+    const U8 opcode = ReadImm8();
+    m_Cycles += k_CyclesPrefixed[opcode];
+    (this->*k_InstructionsPrefixed[opcode])();
+}
 
-    const S8 imm8 = static_cast<S8>(ReadImm8());
-    const U16 sp = m_SP;
-    const U16 result = static_cast<U16>(sp + imm8);
-    m_SP = result;
+// Test ROMs execute ld b, b once done, with the result encoded in the registers
+void CPU::CheckTestResult()
+{
+    if (m_Registers.A == 0x42 && m_Registers.B == 0x42 && m_Registers.C == 0x42 && m_Registers.D == 0x42 &&
+        m_Registers.E == 0x42 && m_Registers.H == 0x42 && m_Registers.L == 0x42)
+    {
+        std::println("Failed!");
+        system("pause");
+    }
+
+    if (m_Registers.B == 3 && m_Registers.C == 5 && m_Registers.D == 8 && m_Registers.E == 13 &&
+        m_Registers.H == 21 && m_Registers.L == 34)
+    {
+        std::println("Success!");
+        system("pause");
+    }
+}
+
+// Opcode 0xDB is unused by the hardware, test ROMs use it as a breakpoint to dump the CPU state
+void CPU::PrintState()
+{
+    std::print("\nA: 0x{:02X} ", m_Registers.A);
+    std::print("B: 0x{:02X} ", m_Registers.B);
+    std::print("C: 0x{:02X} ", m_Registers.C);
+    std::print("D: 0x{:02X} ", m_Registers.D);
+    std::print("E: 0x{:02X} ", m_Registers.E);
+    std::print("H: 0x{:02X} ", m_Registers.H);
+    std::print("L: 0x{:02X} ", m_Registers.L);
+    std::print("HL: 0x{:02X}", Register(Register8::HL));
 
-    Flag(Flags::Z, false);
-    Flag(Flags::N, false);
-    Flag(Flags::H, ((sp & 0x0F) + (imm8 & 0x0F)) > 0x0F);
-    Flag(Flags::C, ((sp & 0xFF) + (imm8 & 0xFF)) > 0xFF);
+    std::println("");
+
+    std::print("Z: {}, ", Flag(Flags::Z));
+    std::print("N: {}, ", Flag(Flags::N));
+    std::print("H: {}, ", Flag(Flags::H));
+    std::println("C: {}\n", Flag(Flags::C));
 }
 
 #pragma endregion
 
 #pragma region Bit Operations
 
-void CPU::Bit(U8 bitIndex, Register8 reg)
+template <U8 bitIndex, CPU::Register8 reg>
+void CPU::Bit()
 {
-    Flag(Flags::Z, (Register(reg) & static_cast<U8>(pow(2, bitIndex))) == 0);
-    Flag(Flags::N, false);
-    Flag(Flags::H, true);
+    PrintInstruction("bit {}, {}", bitIndex, RegisterLiteral(reg));
+
+    m_Flags.zero = Register<reg>() & (1 << bitIndex);
+    m_Flags.subtract = false;
+    m_Flags.half = 0x10;
 }
 
-void CPU::Reset(U8 bitIndex, Register8 reg)
+template <U8 bitIndex, CPU::Register8 reg>
+void CPU::Reset()
 {
-    Register(reg, Register(reg) & ~static_cast<U8>(pow(2, bitIndex)));
+    PrintInstruction("res {}, {}", bitIndex, RegisterLiteral(reg));
+
+    Register<reg>(Register<reg>() & ~static_cast<U8>(1 << bitIndex));
 }
 
-void CPU::Set(U8 bitIndex, Register8 reg)
+template <U8 bitIndex, CPU::Register8 reg>
+void CPU::Set()
 {
-    Register(reg, Register(reg) | static_cast<U8>(pow(2, bitIndex)));
+    PrintInstruction("set {}, {}", bitIndex, RegisterLiteral(reg));
+
+    Register<reg>(Register<reg>() | static_cast<U8>(1 << bitIndex));
 }
 
 #pragma endregion
 
 #pragma endregion
+
+#pragma region Dispatch
+
+template <U8 opcode>
+void CPU::Execute()
+{
+    constexpr U8 block = opcode & 0xC0;
+    constexpr U8 params = opcode & 0x3F;
+
+    if constexpr (block == 0x00)
+    {
+        constexpr Register16 r16 = k_R16[(params & 0x30) >> 4];
+        constexpr Register16 r16mem = k_R16mem[(params & 0x30) >> 4];
+        constexpr Register8 r8 = k_R8[(params & 0x38) >> 3];
+        constexpr U8 cond = (params >> 3) & 0x03;
+
+        if constexpr (params == 0x00) {} // nop
+        else if constexpr (params == 0x07) RotateLeftCarryAccumulator(); // rlca
+        else if constexpr (params == 0x08) LoadFromStackPointer(); // ld [imm16], sp
+        else if constexpr (params == 0x0F) RotateRightCarryAccumulator(); // rrca
+        else if constexpr (params == 0x10) Stop(); // stop
+        else if constexpr (params == 0x17) RotateLeftAccumulator(); // rla
+        else if constexpr (params == 0x18) JumpRelative(); // jr imm8
+        else if constexpr (params == 0x1F) RotateRightAccumulator(); // rra
+        else if constexpr (params == 0x27) DecimalAdjustAccumulator(); // daa
+        else if constexpr (params == 0x2F) ComplementAccumulator(); // cpl
+        else if constexpr (params == 0x37) SetCarryFlag(); // scf
+        else if constexpr (params == 0x3F) ComplementCarryFlag(); // ccf
+        else if constexpr ((params & 0x0F) == 0x1) LoadImm16ToR16<r16>(); // ld r16, imm16
+        else if constexpr ((params & 0x0F) == 0x2) LoadAccumulatorToR16Address<r16mem>(); // ld [r16mem], a
+        else if constexpr ((params & 0x0F) == 0x3) Increment<r16>(); // inc r16
+        else if constexpr ((params & 0x0F) == 0x9) Add<r16>(); // add hl, r16
+        else if constexpr ((params & 0x0F) == 0xA) LoadR16AddressToAccumulator<r16mem>(); // ld a, [r16mem]
+        else if constexpr ((params & 0x0F) == 0xB) Decrement<r16>(); // dec r16
+        else if constexpr ((params & 0x07) == 0x4) Increment<r8>(); // inc r8
+        else if constexpr ((params & 0x07) == 0x5) Decrement<r8>(); // dec r8
+        else if constexpr ((params & 0x07) == 0x6) LoadImm8ToR8<r8>(); // ld r8, imm8
+        else if constexpr ((params & 0x27) == 0x20) JumpRelativeConditional<cond>(); // jr cond, imm8
+    }
+    else if constexpr (block == 0x40) // Block 1: 8-bit Register-To-Register loads
+    {
+        if constexpr (params == 0x36) Halt(); // halt
+        else if constexpr (params == 0x00) CheckTestResult(); // ld b, b (test breakpoint)
+        else LoadR8ToR8<k_R8[(params >> 3) & 0x07], k_R8[params & 0x07]>(); // ld r8, r8
+    }
+    else if constexpr (block == 0x80) // Block 2: 8-bit arithmetic
+    {
+        constexpr Register8 operand = k_R8[params & 0x07];
+        constexpr U8 operation = (params & 0x38) >> 3;
+
+        if constexpr (operation == 0x0) Add<operand>(); // add a, r8
+        else if constexpr (operation == 0x1) Adc<operand>(); // adc a, r8
+        else if constexpr (operation == 0x2) Sub<operand>(); // sub a, r8
+        else if constexpr (operation == 0x3) Sbc<operand>(); // sbc a, r8
+        else if constexpr (operation == 0x4) And<operand>(); // and a, r8
+        else if constexpr (operation == 0x5) Xor<operand>(); // xor a, r8
+        else if constexpr (operation == 0x6) Or<operand>(); // or a, r8
+        else Cp<operand>(); // cp a, r8
+    }
+    else
+    {
+        constexpr U8 cond = (params & 0x18) >> 3;
+        constexpr U8 tgt3 = (params & 0x38) >> 3;
+        constexpr Register16 r16stk = k_R16stk[(params & 0x30) >> 4];
+
+        if constexpr (params == 0x03) Jump<Register16::Imm16>(); // jp imm16
+        else if constexpr (params == 0x06) Add<Register8::Imm8>(); // add a, imm8
+        else if constexpr (params == 0x09) Return(); // ret
+        else if constexpr (params == 0x0B) Prefix(); // prefix 0xCB
+        else if constexpr (params == 0x0D) Call(); // call imm16
+        else if constexpr (params == 0x0E) Adc<Register8::Imm8>(); // adc a, imm8
+        else if constexpr (params == 0x16) Sub<Register8::Imm8>(); // sub a, imm8
+        else if constexpr (params == 0x19) ReturnI(); // reti
+        else if constexpr (params == 0x1B) PrintState(); // debug breakpoint
+        else if constexpr (params == 0x1E) Sbc<Register8::Imm8>(); // sbc a, imm8
+        else if constexpr (params == 0x20) LoadHighFromAccumulator<Register8::Imm8>(); // ldh [imm8], a
+        else if constexpr (params == 0x22) LoadHighFromAccumulator<Register8::C>(); // ldh [c], a
+        else if constexpr (params == 0x26) And<Register8::Imm8>(); // and a, imm8
+        else if constexpr (params == 0x28) AddSP(); // add sp, imm8
+        else if constexpr (params == 0x29) Jump<Register16::HL>(); // jp hl
+        else if constexpr (params == 0x2A) LoadAccumulatorToR16Address<Register16::Imm16>(); // ld [imm16], a
+        else if constexpr (params == 0x2E) Xor<Register8::Imm8>(); // xor a, imm8
+        else if constexpr (params == 0x30) LoadHighToAccumulator<Register8::Imm8>(); // ldh a, [imm8]
+        else if constexpr (params == 0x32) LoadHighToAccumulator<Register8::C>(); // ldh a, [c]
+        else if constexpr (params == 0x33) DisableInterrupts(); // di
+        else if constexpr (params == 0x36) Or<Register8::Imm8>(); // or a, imm8
+        else if constexpr (params == 0x38) LoadSPOffsetToHL(); // ld hl, sp + imm8
+        else if constexpr (params == 0x39) LoadHLToSP(); // ld sp, hl
+        else if constexpr (params == 0x3A) LoadR16AddressToAccumulator<Register16::Imm16>(); // ld a, [imm16]
+        else if constexpr (params == 0x3B) EnableInterrupts(); // ei
+        else if constexpr (params == 0x3E) Cp<Register8::Imm8>(); // cp a, imm8
+        else if constexpr ((params & 0x27) == 0x00) ReturnConditional<cond>(); // ret cond
+        else if constexpr ((params & 0x0F) == 0x01) Pop<r16stk>(); // pop r16stk
+        else if constexpr ((params & 0x27) == 0x02) JumpConditional<cond>(); // jp cond, imm16
+        else if constexpr ((params & 0x27) == 0x04) CallConditional<cond>(); // call cond, imm16
+        else if constexpr ((params & 0x0F) == 0x05) Push<r16stk>(); // push r16stk
+        else if constexpr ((params & 0x07) == 0x07) Restart<tgt3>(); // rst tgt3
+    }
+}
+
+template <U8 opcode>
+void CPU::ExecutePrefixed()
+{
+    constexpr U8 block = (opcode & 0xC0) >> 6;
+    constexpr U8 bitIndex = (opcode & 0x38) >> 3;
+    constexpr Register8 operand = k_R8[opcode & 0x07];
+
+    if constexpr (block == 0x0)
+    {
+        if constexpr (bitIndex == 0x0) RotateLeftCarry<operand>(); // rlc r8
+        else if constexpr (bitIndex == 0x1) RotateRightCarry<operand>(); // rrc r8
+        else if constexpr (bitIndex == 0x2) RotateLeft<operand>(); // rl r8
+        else if constexpr (bitIndex == 0x3) RotateRight<operand>(); // rr r8
+        else if constexpr (bitIndex == 0x4) ShiftLeft<operand>(); // sla r8
+        else if constexpr (bitIndex == 0x5) ShiftRight<operand>(); // sra r8
+        else if constexpr (bitIndex == 0x6) Swap<operand>(); // swap r8
+        else ShiftRightLogically<operand>(); // srl r8
+    }
+    else if constexpr (block == 0x1) Bit<bitIndex, operand>(); // bit b3, r8
+    else if constexpr (block == 0x2) Reset<bitIndex, operand>(); // res b3, r8
+    else Set<bitIndex, operand>(); // set b3, r8
+}
+
+template <bool prefixed, std::size_t... opcodes>
+constexpr std::array<CPU::Instruction, 256> CPU::MakeInstructionTable(std::index_sequence<opcodes...>)
+{
+    if constexpr (prefixed) return { &CPU::ExecutePrefixed<static_cast<U8>(opcodes)>... };
+    else return { &CPU::Execute<static_cast<U8>(opcodes)>... };
+}
+
+const std::array<CPU::Instruction, 256> CPU::k_Instructions =
+    MakeInstructionTable<false>(std::make_index_sequence<256>{});
+
+const std::array<CPU::Instruction, 256> CPU::k_InstructionsPrefixed =
+    MakeInstructionTable<true>(std::make_index_sequence<256>{});
+
+#ifdef RECOMPILER
+
+bool CPU::RunNative(Bus& bus, U64 end)
+{
+    // Native code is entered at the start of a block, never while halted, and leaves interrupt
+    // dispatch to Step. Once the event a translation stopped short of has fired, the rest of the
+    // block is looked up as a block of its own rather than interpreted to its end.
+    if (m_Halted || m_HaltBug) return false;
+    if (!AtBlockBoundary())
+    {
+        if (m_Scheduler.Now() < m_NativeResume) return false;
+        m_NativeResume = Scheduler::NEVER;
+    }
+    if (m_IME_Next_Cycle || (m_IME && (bus.InterruptFlags() & bus.InterruptEnable() & 0x1F))) return false;
+
+    auto& block = EnterBlock(bus);
+    if (m_SkipIdleLoops && SkipIdleLoop(block, end)) return true;
+    if (block.native == nullptr)
+    {
+        // Code that rewrites itself is dropped from the cache on the write, and its translation with it
+        if (++block.entries != Recompiler::HOT_BLOCK_ENTRIES) return false;
+
+        if (!m_Recompiler.Compile(block, NativeEnvironment()))
+        {
+            // The code buffer is full: start over, hot blocks get translated again
+            m_BlockCache.Clear();
+            return false;
+        }
+    }
+
+    // No event may fire in the middle of an instruction, the interpreter steps over it instead
+    const U64 now = m_Scheduler.Now();
+    const U64 limit = std::min({ m_Scheduler.NextDeadline(), end, now + k_MaxNativeRun });
+    if (limit < now + block.entryCycles)
+    {
+        m_NativeResume = limit;
+        return false;
+    }
+
+    m_NativeStart = now;
+    m_NativeDeadline = m_Scheduler.NextDeadline();
+    m_NativeCycles = 0;
+
+    // A write to its own code drops the block while it runs; only look at it again if it survived
+    const Address start = block.start;
+    const U32 cycles = block.native(this, static_cast<U32>(limit - now));
+    m_Scheduler.Advance(static_cast<U32>(now + cycles - m_Scheduler.Now()));
+    m_Cursor = m_BlockEnd;
+
+    // Stopped inside the block: interpret from there up to the next event
+    if (m_BlockGeneration == m_BlockCache.Generation() && m_PC != start)
+    {
+        const auto& instructions = block.instructions;
+        const auto stop = std::find_if(instructions.begin(), instructions.end(),
+            [this](const BlockCache::DecodedInstruction& instruction) { return instruction.address == m_PC; });
+
+        if (stop != instructions.end())
+        {
+            m_Cursor = &*stop;
+            m_NativeResume = std::min(m_Scheduler.NextDeadline(), limit);
+        }
+    }
+    return true;
+}
+
+// Runs one instruction for native code, the way Step would at that point of the pass
+template <U8 opcode>
+bool CPU::StepNative(CPU* cpu, const BlockCache::DecodedInstruction* instruction, U32 offset)
+{
+    // Handlers of I/O registers read the clock, catch it up to the start of the instruction
+    auto& scheduler = cpu->m_Scheduler;
+    scheduler.Advance(static_cast<U32>(cpu->m_NativeStart + cpu->m_NativeCycles + offset - scheduler.Now()));
+
+    cpu->m_Immediate = instruction->operands;
+    cpu->m_PC = static_cast<U16>(instruction->address + 1);
+    cpu->m_Cycles = k_Cycles[opcode];
+    cpu->Execute<opcode>();
+
+    // Stay only while the rest of the block still runs the way it was translated
+    const Address next = static_cast<Address>(instruction->address + BlockCache::InstructionLength(opcode));
+    const bool interrupt = cpu->m_IME && (cpu->m_Bus.InterruptFlags() & cpu->m_Bus.InterruptEnable() & 0x1F);
+    return cpu->m_PC == next && cpu->m_BlockGeneration == cpu->m_BlockCache.Generation() &&
+        scheduler.NextDeadline() == cpu->m_NativeDeadline && !cpu->m_IME_Next_Cycle && !interrupt;
+}
+
+void CPU::InvalidateNative(CPU* cpu, U32 address)
+{
+    cpu->m_BlockCache.Invalidate(static_cast<Address>(address));
+}
+
+Recompiler::Environment CPU::NativeEnvironment()
+{
+    const auto offset = [this](const void* field)
+    {
+        return static_cast<S32>(static_cast<const U8*>(field) - reinterpret_cast<const U8*>(this));
+    };
+
+    Recompiler::Environment environment;
+    environment.a = offset(&m_Registers.A);
+    environment.bc = offset(&m_Registers.BC);
+    environment.de = offset(&m_Registers.DE);
+    environment.hl = offset(&m_Registers.HL);
+    environment.sp = offset(&m_SP);
+    environment.pc = offset(&m_PC);
+    environment.zero = offset(&m_Flags.zero);
+    environment.half = offset(&m_Flags.half);
+    environment.carry = offset(&m_Flags.carry);
+    environment.subtract = offset(&m_Flags.subtract);
+    environment.passCycles = offset(&m_NativeCycles);
+    environment.stepCycles = offset(&m_Cycles);
+    environment.cycles = k_Cycles;
+    environment.cyclesPrefixed = k_CyclesPrefixed;
+    environment.jumpTakenCycles = k_JumpTakenCycles;
+    environment.maxTakenCycles = std::max({ k_JumpTakenCycles, k_CallTakenCycles, k_ReturnTakenCycles });
+    environment.readPages = m_Bus.ReadPages();
+    environment.writePages = m_Bus.WritePages();
+    environment.highRAM = m_Bus.HighRAM();
+    environment.codeBytes = m_BlockCache.CodeBytes();
+    environment.steps = &k_NativeSteps;
+    environment.invalidate = &CPU::InvalidateNative;
+    return environment;
+}
+
+template <std::size_t... opcodes>
+constexpr std::array<Recompiler::Step, 256> CPU::MakeNativeTable(std::index_sequence<opcodes...>)
+{
+    return { &CPU::StepNative<static_cast<U8>(opcodes)>... };
+}
+
+const std::array<Recompiler::Step, 256> CPU::k_NativeSteps = MakeNativeTable(std::make_index_sequence<256>{});
+
+#endif
+
+#ifdef THREADED_DISPATCH
+
+#define OPCODE_ROW(X, hi) \
+    X(0x##hi##0) X(0x##hi##1) X(0x##hi##2) X(0x##hi##3) X(0x##hi##4) X(0x##hi##5) X(0x##hi##6) X(0x##hi##7) \
+    X(0x##hi##8) X(0x##hi##9) X(0x##hi##A) X(0x##hi##B) X(0x##hi##C) X(0x##hi##D) X(0x##hi##E) X(0x##hi##F)
+
+#define OPCODES(X) \
+    OPCODE_ROW(X, 0) OPCODE_ROW(X, 1) OPCODE_ROW(X, 2) OPCODE_ROW(X, 3) \
+    OPCODE_ROW(X, 4) OPCODE_ROW(X, 5) OPCODE_ROW(X, 6) OPCODE_ROW(X, 7) \
+    OPCODE_ROW(X, 8) OPCODE_ROW(X, 9) OPCODE_ROW(X, A) OPCODE_ROW(X, B) \
+    OPCODE_ROW(X, C) OPCODE_ROW(X, D) OPCODE_ROW(X, E) OPCODE_ROW(X, F)
+
+// Direct-threaded core: every handler ends with its own fetch and indirect jump, so the branch
+// predictor sees one dispatch site per opcode instead of the single shared one in Step.
+void CPU::StepThreaded(Bus& bus, U64 end)
+{
+#define THREADED_LABEL(opcode) &&Opcode_##opcode,
+#define THREADED_HANDLER(opcode) Opcode_##opcode: Execute<opcode>(); m_Scheduler.Advance(m_Cycles); DISPATCH();
+#define DISPATCH()                                                              \
+    for (;;)                                                                    \
+    {                                                                           \
+        if (m_Scheduler.Now() >= end || !Running()) return;                     \
+        while (m_Halted || m_HaltBug)                                           \
+        {                                                                       \
+            Step(bus, end);                                                     \
+            if (m_Scheduler.Now() >= end || !Running()) return;                 \
+        }                                                                       \
+        m_Cycles = 0;                                                           \
+        if (m_SkipIdleLoops && AtBlockBoundary() && SkipIdleLoop(EnterBlock(bus), end)) continue; \
+        ServiceInterrupts(bus);                                                 \
+        const U8 opcode = Fetch(bus);                                           \
+        m_Cycles += k_Cycles[opcode];                                           \
+        goto *labels[opcode];                                                   \
+    }
+
+    static void* const labels[256] = { OPCODES(THREADED_LABEL) };
+
+    DISPATCH();
+    OPCODES(THREADED_HANDLER)
+
+#undef DISPATCH
+#undef THREADED_HANDLER
+#undef THREADED_LABEL
+}
+
+#undef OPCODES
+#undef OPCODE_ROW
+
+#endif
+
+#pragma endregion
@@ -1,13 +1,37 @@
 #pragma once
+#include <array>
 #include <format>
 #include <fstream>
-#include <map>
-#include <memory>
+#include <string_view>
+#include <utility>
 
+#include "BlockCache.hpp"
 #include "Bus.hpp"
-#include "LCD.hpp"
+#include "Scheduler.hpp"
 #include "Utility/Types.hpp"
 
+// Build the interpreter as a direct-threaded core (labels-as-values), GCC and Clang only
+// #define THREADED_DISPATCH
+
+// Translate hot ROM blocks to native x86-64 code, everything else keeps running on the interpreter
+// #define RECOMPILER
+
+#if defined(THREADED_DISPATCH) && !defined(__GNUC__)
+#error "THREADED_DISPATCH requires the labels-as-values extension (GCC/Clang)"
+#endif
+
+#if defined(RECOMPILER) && !(defined(_M_X64) || defined(__x86_64__))
+#error "RECOMPILER only targets x86-64 hosts"
+#endif
+
+#if defined(RECOMPILER) && defined(THREADED_DISPATCH)
+#error "RECOMPILER and THREADED_DISPATCH are separate execution modes, pick one"
+#endif
+
+#ifdef RECOMPILER
+#include "Recompiler.hpp"
+#endif
+
 class CPU
 {
     std::ofstream m_Log;
@@ -47,8 +71,25 @@ public:
         C = 0x10
     };
 
+    // Packed register file. The 8-bit registers alias the low/high halves of their 16-bit pair,
+    // so both views are a plain load/store (host is assumed to be little-endian). F is not kept
+    // here but in FlagState; its byte stays zero.
+    struct alignas(16) RegisterFile
+    {
+        union { struct { U8 F, A; }; U16 AF; };
+        union { struct { U8 C, B; }; U16 BC; };
+        union { struct { U8 E, D; }; U16 DE; };
+        union { struct { U8 L, H; }; U16 HL; };
+
+        U8& operator[](Register8 reg) { return reinterpret_cast<U8*>(this)[k_Offsets[static_cast<U8>(reg)]]; }
+
+    private:
+        // Byte offset of each Register8 (A, B, C, D, E, F, H, L) inside the file
+        static constexpr U8 k_Offsets[] = { 1, 3, 2, 5, 4, 0, 7, 6 };
+    };
+
 public:
-    CPU(const std::shared_ptr<Bus>& bus, const std::shared_ptr<LCD>& lcd);
+    CPU(Bus& bus, Scheduler& scheduler);
 
     void SavePixels();    
     void Bootstrap();
@@ -59,8 +100,18 @@ public:
     void Register(Register8 reg, U8 value);
     void Register(Register16 reg, const U16& value);
 
+    // Compile-time operand access, used by the instruction handlers
+    template <Register8 reg> U8 Register();
+    template <Register16 reg> U16 Register();
+    template <Register8 reg> void Register(U8 value);
+    template <Register16 reg> void Register(U16 value);
+
     void Flag(Flags flag, bool set);
-    bool Flag(Flags flag);
+    bool Flag(Flags flag) const;
+
+    // F as the hardware has it, assembled from the lazy flag state
+    U8 PackFlags() const;
+    void UnpackFlags(U8 flags);
 
     U8 ReadImm8();
     U16 ReadImm16();
@@ -71,16 +122,28 @@ public:
     U8 Pop();
     U16 Pop16();
     void Pop(Register16 reg);
+    template <Register16 reg> void Push();
+    template <Register16 reg> void Pop();
 
     bool Condition(U8 condition);
+    template <U8 condition> bool Condition();
+
+    // Executes one instruction (after servicing a pending interrupt) and returns the T-cycles it took
+    U32 Step();
+
+    // Executes instructions until at least `cycles` T-cycles have passed or the CPU stops, and
+    // returns the T-cycles actually run (the last instruction may overshoot)
+    U64 Run(U64 cycles);
 
-    void Step();
-    void Step(U16 address);
+    bool Running() const { return m_PC < 0xFFFF; }
+
+    // Idle loops are skipped by default; turn it off to compare against plain execution
+    void SetIdleLoopSkipping(bool enabled) { m_SkipIdleLoops = enabled; }
 
     template <class... Types>
     static void PrintInstruction(const std::format_string<Types...>& text, Types&&... args);
 
-    inline static std::string ConditionLiteral(U8 cond)
+    static constexpr std::string_view ConditionLiteral(U8 cond)
     {
         if (cond == 0x0) return "NZ";
         else if (cond == 0x1) return "Z";
@@ -89,12 +152,12 @@ public:
         else return "???";
     }
 
-    inline static std::string FlagLiteral(Flags flag)
+    static constexpr std::string_view FlagLiteral(Flags flag)
     {
         return flag == Flags::C ? "C" : flag == Flags::H ? "H" : flag == Flags::N ? "N" : "Z";
     }
 
-    inline static std::string RegisterLiteral(Register8 reg)
+    static constexpr std::string_view RegisterLiteral(Register8 reg)
     {
         switch (reg)
         {
@@ -113,7 +176,7 @@ public:
         return "???";
     }
 
-    inline static std::string RegisterLiteral(Register16 reg)
+    static constexpr std::string_view RegisterLiteral(Register16 reg)
     {
         switch (reg)
         {
@@ -134,39 +197,39 @@ public:
 #pragma region Instructions
     // 16-bit Load Instructions
     void LoadFromStackPointer();
-    void LoadImm16ToR16(Register16 reg);
-    void LoadAccumulatorToR16Address(Register16 reg);
-    void LoadR16AddressToAccumulator(Register16 reg);
+    template <Register16 reg> void LoadImm16ToR16();
+    template <Register16 reg> void LoadAccumulatorToR16Address();
+    template <Register16 reg> void LoadR16AddressToAccumulator();
     void LoadSPOffsetToHL();
     void LoadHLToSP();
 
     // 8-bit Load Instructions
-    void LoadImm8ToR8(Register8 reg);
-    void LoadR8ToR8(Register8 left, Register8 right);
-    void LoadHighToAccumulator(Register8 reg);
-    void LoadHighFromAccumulator(Register8 reg);
+    template <Register8 reg> void LoadImm8ToR8();
+    template <Register8 left, Register8 right> void LoadR8ToR8();
+    template <Register8 reg> void LoadHighToAccumulator();
+    template <Register8 reg> void LoadHighFromAccumulator();
 
     // 8-bit Arithmetic and Logical Instructions
-    void Add(Register8 reg);
-    void Adc(Register8 reg);
-    void Sub(Register8 reg);
-    void Sbc(Register8 reg);
-    void And(Register8 reg);
-    void Xor(Register8 reg);
-    void Or(Register8 reg);
-    void Cp(Register8 reg);
-    void Increment(Register8 reg);
-    void Decrement(Register8 reg);
+    template <Register8 reg> void Add();
+    template <Register8 reg> void Adc();
+    template <Register8 reg> void Sub();
+    template <Register8 reg> void Sbc();
+    template <Register8 reg> void And();
+    template <Register8 reg> void Xor();
+    template <Register8 reg> void Or();
+    template <Register8 reg> void Cp();
+    template <Register8 reg> void Increment();
+    template <Register8 reg> void Decrement();
     void DecimalAdjustAccumulator();
     void ComplementAccumulator();
     void SetCarryFlag();
     void ComplementCarryFlag();
 
     // 16-bit Arithmetic
-    void Add(Register16 reg);
+    template <Register16 reg> void Add();
     void AddSP();
-    void Increment(Register16 reg);
-    void Decrement(Register16 reg);
+    template <Register16 reg> void Increment();
+    template <Register16 reg> void Decrement();
 
     // Rotate, Shift and Bit Instructions
     void RotateLeftCarryAccumulator();
@@ -174,54 +237,219 @@ public:
     void RotateLeftAccumulator();
     void RotateRightAccumulator();
 
-    void RotateLeftCarry(Register8 reg);
-    void RotateRightCarry(Register8 reg);
-    void RotateLeft(Register8 reg);
-    void RotateRight(Register8 reg);
+    template <Register8 reg> void RotateLeftCarry();
+    template <Register8 reg> void RotateRightCarry();
+    template <Register8 reg> void RotateLeft();
+    template <Register8 reg> void RotateRight();
 
-    void ShiftLeft(Register8 reg);
-    void ShiftRight(Register8 reg);
-    void ShiftRightLogically(Register8 reg);
+    template <Register8 reg> void ShiftLeft();
+    template <Register8 reg> void ShiftRight();
+    template <Register8 reg> void ShiftRightLogically();
 
-    void Swap(Register8);
+    template <Register8 reg> void Swap();
 
-    void Bit(U8 bitIndex, Register8 reg);
-    void Reset(U8 bitIndex, Register8 reg);
-    void Set(U8 bitIndex, Register8 reg);
+    template <U8 bitIndex, Register8 reg> void Bit();
+    template <U8 bitIndex, Register8 reg> void Reset();
+    template <U8 bitIndex, Register8 reg> void Set();
 
     // Control Flow Instructions
     void Call();
-    void CallConditional(U8 cond);
-    void Jump(Register16 reg);
-    void JumpConditional(U8 cond);
+    template <U8 cond> void CallConditional();
+    template <Register16 reg> void Jump();
+    template <U8 cond> void JumpConditional();
     void JumpRelative();
-    void JumpRelativeConditional(U8 cond);
+    template <U8 cond> void JumpRelativeConditional();
     void Return();
     void ReturnI();
-    void ReturnConditional(U8 cond);
-    void Restart(U8 vec);
+    template <U8 cond> void ReturnConditional();
+    template <U8 vec> void Restart();
 
     // Miscellaneous Instructions
     void Stop() const;
+    void Halt();
     void DisableInterrupts();
     void EnableInterrupts();
+    void Prefix();
+    void CheckTestResult();
+    void PrintState();
 
 #pragma endregion
 
 private:
-    std::map<Register8, U8> m_Registers;
-    std::weak_ptr<Bus> m_Bus;
-    std::weak_ptr<LCD> m_LCD;
+    // Operand decode tables, indexed by the register field of the opcode
+    static constexpr Register8 k_R8[] = {
+        Register8::B, Register8::C, Register8::D, Register8::E,
+        Register8::H, Register8::L, Register8::HL, Register8::A
+    };
+    static constexpr Register16 k_R16[] = { Register16::BC, Register16::DE, Register16::HL, Register16::SP };
+    static constexpr Register16 k_R16stk[] = { Register16::BC, Register16::DE, Register16::HL, Register16::AF };
+    static constexpr Register16 k_R16mem[] = { Register16::BC, Register16::DE, Register16::HLi, Register16::HLd };
+
+    // Opcode dispatch. Every opcode of the main and 0xCB pages gets its own handler, generated at
+    // compile time from Execute<opcode> / ExecutePrefixed<opcode> with all operands baked in.
+    using Instruction = void (CPU::*)();
+
+    template <U8 opcode> void Execute();
+    template <U8 opcode> void ExecutePrefixed();
+
+    // T-cycles per opcode. Conditional jr/jp/call/ret list their not-taken cost and add the
+    // difference when the branch is taken; 0xCB takes its whole cost from the prefixed table.
+    static constexpr U8 k_Cycles[256] = {
+         4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0x0_
+         4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 0x1_
+         8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 0x2_
+         8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 0x3_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x4_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x5_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x6_
+         8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 0x7_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x8_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x9_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0xA_
+         4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0xB_
+         8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  0, 12, 24,  8, 16, // 0xC_
+         8, 12, 12,  4, 12, 16,  8, 16,  8, 16, 12,  4, 12,  4,  8, 16, // 0xD_
+        12, 12,  8,  4,  4, 16,  8, 16, 16,  4, 16,  4,  4,  4,  8, 16, // 0xE_
+        12, 12,  8,  4,  4, 16,  8, 16, 12,  8, 16,  4,  4,  4,  8, 16, // 0xF_
+    };
+
+    static constexpr U8 k_CyclesPrefixed[256] = {
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0x0_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0x1_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0x2_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0x3_
+         8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8, // 0x4_
+         8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8, // 0x5_
+         8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8, // 0x6_
+         8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8, // 0x7_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0x8_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0x9_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0xA_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0xB_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0xC_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0xD_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0xE_
+         8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8, // 0xF_
+    };
+
+    static constexpr U8 k_JumpTakenCycles = 4;
+    static constexpr U8 k_CallTakenCycles = 12;
+    static constexpr U8 k_ReturnTakenCycles = 12;
+    static constexpr U8 k_InterruptCycles = 20;
+
+    // Upper bound for a single halted step when nothing is scheduled
+    static constexpr U64 k_MaxHaltSkip = 0x10000;
+
+#ifdef RECOMPILER
+    // Upper bound for a single call into native code when nothing is scheduled
+    static constexpr U64 k_MaxNativeRun = 0x10000;
+#endif
+
+    // Interrupt dispatch before an instruction and the opcode fetch; the scheduler is advanced by
+    // the cycles the instruction took afterwards. While halted, a step skips ahead to the next
+    // scheduled event, but never past `end`.
+    U32 Step(Bus& bus, U64 end);
+    void ServiceInterrupts(Bus& bus);
+    U8 Fetch(Bus& bus);
+    bool AtBlockBoundary() const;
+    BlockCache::Block& EnterBlock(Bus& bus);
 
-    std::map<U8, Register8> m_R8;
-    std::map<U8, Register16> m_R16;
-    std::map<U8, Register16> m_R16stk;
-    std::map<U8, Register16> m_R16mem;
+    // Called on every block entry. Once a pass through an idle loop ended in the state it started in,
+    // with no event in between, every further pass is identical until the next event: those are
+    // skipped in one go. Returns true when cycles were skipped.
+    bool SkipIdleLoop(const BlockCache::Block& block, U64 end);
 
+#ifdef THREADED_DISPATCH
+    void StepThreaded(Bus& bus, U64 end);
+#endif
+
+    template <bool prefixed, std::size_t... opcodes>
+    static constexpr std::array<Instruction, 256> MakeInstructionTable(std::index_sequence<opcodes...>);
+
+    static const std::array<Instruction, 256> k_Instructions;
+    static const std::array<Instruction, 256> k_InstructionsPrefixed;
+
+#ifdef RECOMPILER
+    // Runs the native translation of the block at PC, if there is one; false means interpret instead
+    bool RunNative(Bus& bus, U64 end);
+
+    // Translations call these for everything they don't do inline, see Recompiler::Step
+    template <U8 opcode>
+    static bool StepNative(CPU* cpu, const BlockCache::DecodedInstruction* instruction, U32 offset);
+    static void InvalidateNative(CPU* cpu, U32 address);
+
+    Recompiler::Environment NativeEnvironment();
+
+    template <std::size_t... opcodes>
+    static constexpr std::array<Recompiler::Step, 256> MakeNativeTable(std::index_sequence<opcodes...>);
+
+    static const std::array<Recompiler::Step, 256> k_NativeSteps;
+#endif
+
+    // Lazily evaluated flags. The ALU helpers only store what the flags derive from, mostly values
+    // they computed anyway; Z, H and C are extracted when a condition, push af, daa or a rotate
+    // through carry reads them, and flags an instruction leaves alone are simply not touched.
+    struct FlagState
+    {
+        U8 zero = 1;           // Z is set while this is 0, usually the 8-bit result
+        U8 half = 0;           // H is bit 4, usually lhs ^ rhs ^ result
+        U16 carry = 0;         // C is bit 8, usually the unwrapped result
+        bool subtract = false; // N
+    };
+
+    RegisterFile m_Registers;
+    FlagState m_Flags;
     U16 m_SP;
     U16 m_PC;
+
+    // Owned by the console, which outlives the CPU
+    Bus& m_Bus;
+    Scheduler& m_Scheduler;
+
+    // Instructions are fetched from decoded blocks; m_Immediate points at the operands of the current one
+    BlockCache m_BlockCache;
+    const BlockCache::DecodedInstruction* m_Cursor;
+    const BlockCache::DecodedInstruction* m_BlockEnd;
+    U32 m_BlockGeneration;
+    const U8* m_Immediate;
+
+    // T-cycles taken by the instruction being executed
+    U32 m_Cycles;
+
+#ifdef RECOMPILER
+    Recompiler m_Recompiler;
+
+    // While native code runs: when it was entered, the next event at that point and the T-cycles of
+    // the passes it completed
+    U64 m_NativeStart;
+    U64 m_NativeDeadline;
+    U32 m_NativeCycles;
+
+    // When a translation stopped short of an event, the interpreter runs until then
+    U64 m_NativeResume;
+#endif
+
     bool m_IME;
     bool m_IME_Next_Cycle;
     bool m_Interrupting;
     U8 m_Wait;
+
+    bool m_Halted;
+    bool m_HaltBug;
+    U8 m_HaltBugOperands[2];
+
+    // State at the last arrival at the head of an idle loop candidate
+    struct IdleLoop
+    {
+        Address start = 0xFFFF;
+        RegisterFile registers;
+        U8 flags = 0;
+        U16 sp = 0;
+        U64 timestamp = 0;
+        U64 deadline = 0;
+        U32 volatileReads = 0;
+    };
+
+    bool m_SkipIdleLoops;
+    IdleLoop m_IdleLoop;
 };
@@ -2,34 +2,33 @@
 
 #include "Utility/Types.hpp"
 
-#include <fstream>
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
 #include <print>
 
-Cartridge::Cartridge(const std::string& file)
+Cartridge::Cartridge(const std::string& file, const Scheduler& scheduler) : m_Clock(scheduler)
 {
-    std::ifstream input(file, std::ios::binary);
-
-    if (input.fail())
+    // The header is parsed straight from the mapping and ROM pages are only read once code runs there
+    if (!m_File.Open(file))
     {
         std::cerr << "Failed to open file: " << file << '\n';
         std::cin.get();
         exit(127);
     }
 
-    int byteCounter = 0;
-    while (!input.eof())
-    {
-        Byte byte;
-        input.read(reinterpret_cast<char*>(&byte), sizeof(Byte));
-        m_ROM.emplace_back(byte);
-
-        byteCounter++;
-    }
-
-    input.close();
+    m_ROM = std::span(m_File.Data(), m_File.Length());
 
     LoadROM();
+    SetupMapper(file);
+}
+
+Cartridge::~Cartridge()
+{
+    SaveClock();
 }
 
 void Cartridge::LoadROM()
@@ -60,11 +59,11 @@ void Cartridge::LoadROM()
         m_CartridgeType == CartridgeType::MBC5_RUMBLE_RAM_BATTERY || m_CartridgeType == CartridgeType::MBC5_RAM ||
         m_CartridgeType == CartridgeType::MBC7_SENSOR_RUMBLE_RAM_BATTERY)
     {
-        m_RAMSize = RAMSize::None;
+        m_RAMSize = static_cast<RAMSize>(m_ROM[0x149]);
     }
     else
     {
-        m_RAMSize = static_cast<RAMSize>(m_ROM[0x149]);
+        m_RAMSize = RAMSize::None;
     }
 
     m_DestinationCode = static_cast<DestinationCode>(m_ROM[0x14A]);
@@ -107,27 +106,231 @@ void Cartridge::VerifyNintendoLogo()
     }
 }
 
-Byte Cartridge::ReadROM(Address address) const
+void Cartridge::SetupMapper(const std::string& file)
 {
-    return m_ROM[address];
+    m_HasHeader = m_ROM.size() >= 0x014F;
+    const bool hasHeader = m_HasHeader;
+    const Byte type = hasHeader ? m_ROM[0x147] : 0x00;
+
+    if (type >= 0x01 && type <= 0x03) m_Mapper = Mapper::MBC1;
+    else if (type >= 0x05 && type <= 0x06) m_Mapper = Mapper::MBC2;
+    else if (type >= 0x0F && type <= 0x13) m_Mapper = Mapper::MBC3;
+    else if (type >= 0x19 && type <= 0x1E) m_Mapper = Mapper::MBC5;
+    else m_Mapper = Mapper::None;
+
+    // Whole banks as the header declares them, so every selectable bank is backed by memory. Stray
+    // trailing bytes are left out of the view; only a short dump has to be copied and zero-filled.
+    const Byte romSize = hasHeader ? m_ROM[0x148] : 0x00;
+    const Size dumpBanks = std::bit_ceil(std::max<Size>((static_cast<Size>(m_ROM.size()) + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE, 2));
+    const Size romBanks = romSize <= 0x08 ? Size{ 2 } << romSize : dumpBanks;
+    if (m_ROM.size() >= romBanks * ROM_BANK_SIZE)
+    {
+        m_ROM = m_ROM.first(romBanks * ROM_BANK_SIZE);
+    }
+    else
+    {
+        m_PaddedROM.assign(m_ROM.begin(), m_ROM.end());
+        m_PaddedROM.resize(romBanks * ROM_BANK_SIZE);
+        m_ROM = m_PaddedROM;
+        m_File.Close();
+    }
+    m_ROMBankMask = static_cast<U32>(romBanks - 1);
+
+    Size ramBanks = 0;
+    switch (hasHeader ? m_RAMSize : RAMSize::None)
+    {
+    case RAMSize::Unused:
+    case RAMSize::_8KB: ramBanks = 1; break;
+    case RAMSize::_32KB: ramBanks = 4; break;
+    case RAMSize::_64KB: ramBanks = 8; break;
+    case RAMSize::_128KB: ramBanks = 16; break;
+    default: break;
+    }
+
+    SetupRAM(file, m_Mapper == Mapper::MBC2 ? MBC2_RAM_SIZE : ramBanks * RAM_BANK_SIZE);
+    m_RAMBankMask = ramBanks > 0 ? static_cast<U32>(ramBanks - 1) : 0;
+
+    // Without a mapper there is nothing to enable the RAM, it is simply there
+    m_RAMEnabled = m_Mapper == Mapper::None;
+
+    SelectBanks();
+}
+
+void Cartridge::SetupRAM(const std::string& file, Size size)
+{
+    const Size clockSize = HasClock() ? RealTimeClock::SAVE_SIZE : 0;
+    if (size + clockSize == 0) return;
+
+    if (HasBattery())
+    {
+        const std::string save = std::filesystem::path(file).replace_extension(".sav").string();
+        if (m_SaveFile.OpenWritable(save, size + clockSize))
+        {
+            m_RAM = std::span(m_SaveFile.WritableData(), size);
+            m_ClockSave = std::span(m_SaveFile.WritableData() + size, clockSize);
+            if (HasClock()) m_Clock.Load(m_ClockSave);
+
+            m_SaveFlusher = std::jthread([this](std::stop_token stop)
+            {
+                std::mutex mutex;
+                std::unique_lock lock(mutex);
+                std::condition_variable_any wakeup;
+                while (!wakeup.wait_for(lock, stop, SAVE_FLUSH_INTERVAL, [&stop] { return stop.stop_requested(); }))
+                {
+                    m_SaveFile.Flush();
+                }
+            });
+            return;
+        }
+
+        std::cerr << "Failed to open save file, progress will not be kept: " << save << '\n';
+    }
+
+    m_VolatileRAM.resize(size);
+    m_RAM = m_VolatileRAM;
+}
+
+bool Cartridge::HasBattery() const
+{
+    switch (m_CartridgeType)
+    {
+    case CartridgeType::MBC1_RAM_BATTERY:
+    case CartridgeType::MBC2_BATTERY:
+    case CartridgeType::ROM_RAM_BATTERY:
+    case CartridgeType::MMM01_RAM_BATTERY:
+    case CartridgeType::MBC3_TIMER_BATTERY:
+    case CartridgeType::MBC3_TIMER_RAM_BATTERY:
+    case CartridgeType::MBC3_RAM_BATTERY:
+    case CartridgeType::MBC5_RAM_BATTERY:
+    case CartridgeType::MBC5_RUMBLE_RAM_BATTERY:
+    case CartridgeType::MBC7_SENSOR_RUMBLE_RAM_BATTERY:
+    case CartridgeType::HuC1_RAM_BATTERY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Cartridge::HasClock() const
+{
+    return m_CartridgeType == CartridgeType::MBC3_TIMER_BATTERY || m_CartridgeType == CartridgeType::MBC3_TIMER_RAM_BATTERY;
 }
 
-std::vector<Byte> Cartridge::ReadROM(Address start, Size length) const
+void Cartridge::SaveClock()
 {
-    std::vector<Byte> data;
-    for (Size i = start; i < start + length; i++)
+    if (!m_ClockSave.empty()) m_Clock.Save(m_ClockSave);
+}
+
+bool Cartridge::Control(Address address, Byte value)
+{
+    switch (m_Mapper)
     {
-        if (i < m_ROM.size())
+    case Mapper::None:
+        return false;
+    case Mapper::MBC1:
+        if (address < 0x2000) m_RAMEnabled = (value & 0x0F) == 0x0A;
+        else if (address < 0x4000) m_BankLow = std::max(value & 0x1F, 1); // Bank 0 selects bank 1
+        else if (address < 0x6000) m_BankHigh = value & 0x03;
+        else m_BankingMode = value & 0x01;
+        break;
+    case Mapper::MBC2:
+        // Both registers sit below 0x4000, address bit 8 tells them apart
+        if (address >= 0x4000) break;
+        if (address & 0x0100) m_BankLow = std::max(value & 0x0F, 1);
+        else m_RAMEnabled = (value & 0x0F) == 0x0A;
+        break;
+    case Mapper::MBC3:
+        if (address < 0x2000) m_RAMEnabled = (value & 0x0F) == 0x0A;
+        else if (address < 0x4000) m_BankLow = std::max(value & 0x7F, 1);
+        else if (address < 0x6000) m_BankHigh = value & 0x0F;
+        else if (HasClock())
         {
-            data.push_back(m_ROM[i]);
+            m_Clock.Latch(value);
+            SaveClock();
         }
-        else
+        break;
+    case Mapper::MBC5:
+        if (address < 0x2000) m_RAMEnabled = (value & 0x0F) == 0x0A;
+        else if (address < 0x3000) m_BankLow = (m_BankLow & 0x100) | value;
+        else if (address < 0x4000) m_BankLow = (m_BankLow & 0x0FF) | ((value & 0x01) << 8);
+        else if (address < 0x6000)
         {
-            data.push_back(0);
+            // Rumble cartridges wire bit 3 to the motor instead
+            const bool rumble = m_CartridgeType >= CartridgeType::MBC5_RUMBLE;
+            m_BankHigh = value & (rumble ? 0x07 : 0x0F);
         }
+        break;
     }
 
-    return data;
+    SelectBanks();
+    return true;
+}
+
+void Cartridge::SelectBanks()
+{
+    switch (m_Mapper)
+    {
+    case Mapper::None:
+        break;
+    case Mapper::MBC1:
+        // BANK2 extends the ROM bank; in mode 1 it also banks 0x0000-0x3FFF and the RAM
+        m_ROMBank0 = m_BankingMode ? (m_BankHigh << 5) & m_ROMBankMask : 0;
+        m_ROMBank1 = ((m_BankHigh << 5) | m_BankLow) & m_ROMBankMask;
+        m_RAMBank = m_BankingMode ? m_BankHigh & m_RAMBankMask : 0;
+        break;
+    case Mapper::MBC2:
+    case Mapper::MBC3:
+    case Mapper::MBC5:
+        m_ROMBank1 = m_BankLow & m_ROMBankMask;
+        m_RAMBank = m_BankHigh & m_RAMBankMask;
+        break;
+    }
+}
+
+Byte* Cartridge::RAMBank()
+{
+    if (!m_RAMEnabled || m_RAM.empty() || m_Mapper == Mapper::MBC2) return nullptr;
+    if (m_Mapper == Mapper::MBC3 && m_BankHigh >= 0x08) return nullptr;
+
+    return m_RAM.data() + m_RAMBank * RAM_BANK_SIZE;
+}
+
+Byte Cartridge::ReadRAM(Address address) const
+{
+    if (!m_RAMEnabled) return 0xFF;
+
+    // 512 4-bit cells repeated over the whole window, the upper nibble is open bus
+    if (m_Mapper == Mapper::MBC2) return 0xF0 | m_RAM[address & (MBC2_RAM_SIZE - 1)];
+
+    if (m_Mapper == Mapper::MBC3 && m_BankHigh >= 0x08 && m_BankHigh <= 0x0C)
+    {
+        return HasClock() ? m_Clock.Read(static_cast<U8>(m_BankHigh - 0x08)) : 0xFF;
+    }
+
+    return 0xFF;
+}
+
+void Cartridge::WriteRAM(Address address, Byte value)
+{
+    if (!m_RAMEnabled) return;
+
+    if (m_Mapper == Mapper::MBC2) m_RAM[address & (MBC2_RAM_SIZE - 1)] = value & 0x0F;
+    else if (m_Mapper == Mapper::MBC3 && m_BankHigh >= 0x08 && m_BankHigh <= 0x0C && HasClock())
+    {
+        m_Clock.Write(static_cast<U8>(m_BankHigh - 0x08), value);
+        SaveClock();
+    }
+}
+
+Byte Cartridge::ReadROM(Address address) const
+{
+    return m_ROM[address];
+}
+
+std::span<const Byte> Cartridge::ROMView(Size offset, Size length) const
+{
+    if (offset >= m_ROM.size()) return {};
+    return m_ROM.subspan(offset, std::min<Size>(length, static_cast<Size>(m_ROM.size()) - offset));
 }
 
 void Cartridge::PrintHeader() const
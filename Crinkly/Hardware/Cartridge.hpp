@@ -1,9 +1,16 @@
 #pragma once
 #include <array>
+#include <chrono>
+#include <span>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "RealTimeClock.hpp"
+#include "Scheduler.hpp"
+#include "Utility/MappedFile.hpp"
 #include "Utility/Types.hpp"
+#include "Utility/Utils.hpp"
 
 class Cartridge
 {
@@ -68,16 +75,35 @@ private:
         Japan = 0x00,
         Overseas = 0x01
     };
+    enum class Mapper : Byte
+    {
+        None,
+        MBC1,
+        MBC2,
+        MBC3,
+        MBC5
+    };
+
+public:
+    static constexpr Size ROM_BANK_SIZE = 16_Kb;
+    static constexpr Size RAM_BANK_SIZE = 8_Kb;
+    static constexpr Size MBC2_RAM_SIZE = 512; // 4-bit cells
+
+    // How often battery-backed RAM is handed to the OS for writing back to the .sav file
+    static constexpr std::chrono::seconds SAVE_FLUSH_INTERVAL { 1 };
     
 public:
-    Cartridge(const std::string& file);
+    Cartridge(const std::string& file, const Scheduler& scheduler);
+    ~Cartridge();
 
     void LoadROM();
 
     void VerifyNintendoLogo();
 
     Byte ReadROM(Address address) const;
-    std::vector<Byte> ReadROM(Address start, Size length) const;
+
+    // The part of [offset, offset + length) of the ROM image that exists, without copying
+    std::span<const Byte> ROMView(Size offset, Size length) const;
     
     std::string GetLicenseeCodeLiteral() const;
     std::string GetCartridgeTypeLiteral() const;
@@ -86,6 +112,24 @@ public:
     std::string GetDestinationCodeLiteral() const;
 
     void PrintHeader() const;
+
+    // Raw programs without a header start at 0x0000 instead of the header entry point
+    bool HasHeader() const { return m_HasHeader; }
+
+    // Memory bank controller. Control() handles a write to 0x0000-0x7FFF and returns false when
+    // there is no mapper to receive it. The bus then maps the banks below straight into its page
+    // table, so switching costs a few pointer stores and no copying.
+    bool Control(Address address, Byte value);
+
+    // The 16 KiB ROM bank currently seen at `address` (0x0000 or 0x4000 area) and its number
+    const Byte* ROMBank(Address address) const { return m_ROM.data() + ROMBankNumber(address) * ROM_BANK_SIZE; }
+    U32 ROMBankNumber(Address address) const { return address < 0x4000 ? m_ROMBank0 : m_ROMBank1; }
+
+    // The 8 KiB RAM bank at 0xA000, or nullptr while the window needs ReadRAM/WriteRAM instead:
+    // RAM disabled or absent, MBC2's 4-bit cells, or an MBC3 clock register selected
+    Byte* RAMBank();
+    Byte ReadRAM(Address address) const;
+    void WriteRAM(Address address, Byte value);
     
     Cartridge(const Cartridge&) = delete;
     Cartridge& operator=(const Cartridge&) = delete;
@@ -100,15 +144,55 @@ private:
     };
 
 public:
-    std::vector<Byte> m_ROM;
+    // The ROM image, whole banks as the header declares them. It points straight into the mapped
+    // file, or into m_PaddedROM when the dump is shorter than its header claims.
+    std::span<const Byte> m_ROM;
 
 private:
+    MappedFile m_File;
+    std::vector<Byte> m_PaddedROM;
+
     std::string m_Title;
     Byte m_OldLicenseeCode;
     Word m_NewLicenseeCode;
-    CartridgeType m_CartridgeType;
+    CartridgeType m_CartridgeType = CartridgeType::ROM_ONLY;
     ROMSize m_ROMSize;
     RAMSize m_RAMSize;
     DestinationCode m_DestinationCode;
     Byte m_MaskROMVersionNumber;
+
+    bool m_HasHeader = false;
+
+    // Mapper registers and the banks they select
+    Mapper m_Mapper = Mapper::None;
+    std::span<Byte> m_RAM;
+    U32 m_ROMBankMask = 1;
+    U32 m_RAMBankMask = 0;
+    U32 m_BankLow = 1;  // MBC1 BANK1, MBC2/MBC3 ROM bank, MBC5 ROMB0 and ROMB1
+    U32 m_BankHigh = 0; // MBC1 BANK2, MBC3/MBC5 RAM bank or clock register
+    bool m_BankingMode = false;
+    bool m_RAMEnabled = false;
+    U32 m_ROMBank0 = 0;
+    U32 m_ROMBank1 = 1;
+    U32 m_RAMBank = 0;
+
+    // MBC3 clock, saved after the RAM in the .sav file when there is one
+    RealTimeClock m_Clock;
+    std::span<Byte> m_ClockSave;
+
+    // External RAM lives in the mapped .sav file on battery-backed cartridges and in m_VolatileRAM
+    // otherwise. The bus writes straight into it, the OS marks the touched pages dirty and the
+    // flusher periodically starts their write-back, so the emulation never waits on the disk.
+    MappedFile m_SaveFile;
+    std::vector<Byte> m_VolatileRAM;
+    std::jthread m_SaveFlusher;
+
+private:
+    void SetupMapper(const std::string& file);
+    void SetupRAM(const std::string& file, Size size);
+    void SelectBanks();
+
+    bool HasBattery() const;
+    bool HasClock() const;
+    void SaveClock();
 };
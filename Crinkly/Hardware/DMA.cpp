@@ -0,0 +1,25 @@
+#include "DMA.hpp"
+
+DMA::DMA(Bus& bus, Scheduler& scheduler) : m_Bus(bus), m_Scheduler(scheduler)
+{
+    m_Scheduler.Register(Scheduler::Event::DMA, [this](U64 timestamp) { Finish(timestamp); });
+
+    m_Bus.OnWrite(0xFF46, [this](Byte value) { Start(value); });
+}
+
+void DMA::Start(Byte source)
+{
+    // Sources above 0xDF00 see work RAM through the echo area. The copy is read before the bus is
+    // restricted; a restart during a transfer simply copies again and extends the window.
+    const Address start = static_cast<Address>((source >= 0xE0 ? source - 0x20 : source) << 8);
+    m_Bus.RestrictToHighRAM(false);
+    m_Bus.Read(start, m_Bus.OAM());
+    m_Bus.RestrictToHighRAM(true);
+
+    m_Scheduler.Schedule(Scheduler::Event::DMA, m_Scheduler.Now() + TRANSFER_CYCLES);
+}
+
+void DMA::Finish(U64)
+{
+    m_Bus.RestrictToHighRAM(false);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "Bus.hpp"
+#include "Scheduler.hpp"
+#include "Utility/Types.hpp"
+
+// OAM DMA. Writing 0xFF46 copies the 160-byte sprite table from the source page in one go; the
+// transfer still takes 160 M-cycles, during which the CPU can only reach 0xFF00-0xFFFF.
+class DMA
+{
+public:
+    static constexpr U32 TRANSFER_CYCLES = 160 * 4;
+
+public:
+    DMA(Bus& bus, Scheduler& scheduler);
+
+private:
+    // DMA (0xFF46) writes
+    void Start(Byte source);
+    void Finish(U64 timestamp);
+
+private:
+    Bus& m_Bus;
+    Scheduler& m_Scheduler;
+};
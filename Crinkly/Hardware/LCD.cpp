@@ -31,17 +31,32 @@ std::string fs = R"(
     }
 )";
 
-LCD::LCD(const std::shared_ptr<Bus>& bus)
-{
-    m_Bus = bus;
+// The frame holds one shade per pixel, top row first; the palette turns shades into colors
+std::string fsPalette = R"(
+    #version 460 core
+    in vec2 TexCoord;
+
+    out vec4 FragColor;
+
+    uniform sampler2D ourTexture;
+    uniform vec3 palette[4];
 
+    void main()
+    {
+        int shade = int(texture(ourTexture, vec2(TexCoord.x, 1.0 - TexCoord.y)).r * 255.0 + 0.5);
+        FragColor = vec4(palette[shade], 1.0);
+    }
+)";
+
+LCD::LCD(const PPU& ppu) : m_PPU(ppu)
+{
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
 
     m_Window = glfwCreateWindow(160 * 3, 144 * 3, "Crinkly", nullptr, nullptr);
-    m_WindowDebug = glfwCreateWindow(128 * 3, 192 * 3, "Crinkly Debug", nullptr, nullptr);
+    m_WindowDebug = glfwCreateWindow(DEBUG_WIDTH * 3, DEBUG_HEIGHT * 3, "Crinkly Debug", nullptr, nullptr);
     if (m_Window == nullptr || m_WindowDebug == nullptr)
     {
         std::println("Failed to create GLFW window");
@@ -65,7 +80,7 @@ LCD::LCD(const std::shared_ptr<Bus>& bus)
     glCompileShader(vertexShader);
 
     unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    const char* fragmentShaderSource = fs.c_str();
+    const char* fragmentShaderSource = fsPalette.c_str();
     glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
     glCompileShader(fragmentShader);
 
@@ -115,18 +130,20 @@ LCD::LCD(const std::shared_ptr<Bus>& bus)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 160, 144, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, PPU::SCREEN_WIDTH, PPU::SCREEN_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
 
     glUseProgram(m_ShaderProgram);
     glUniform1i(glGetUniformLocation(m_ShaderProgram, "ourTexture"), 0);
+    glUniform3fv(glGetUniformLocation(m_ShaderProgram, "palette"), 4, k_Palette);
 
     glfwMakeContextCurrent(m_WindowDebug);
-    glViewport(0, 0, 128 * 3, 192 * 3);
+    glViewport(0, 0, DEBUG_WIDTH * 3, DEBUG_HEIGHT * 3);
 
     vertexShader = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
     glCompileShader(vertexShader);
 
+    fragmentShaderSource = fs.c_str();
     fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
     glCompileShader(fragmentShader);
@@ -165,7 +182,7 @@ LCD::LCD(const std::shared_ptr<Bus>& bus)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 128, 192, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, DEBUG_WIDTH, DEBUG_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
 
     glUseProgram(m_ShaderProgramDebug);
     glUniform1i(glGetUniformLocation(m_ShaderProgramDebug, "ourTexture"), 0);
@@ -180,231 +197,81 @@ LCD::~LCD()
     glfwTerminate();
 }
 
-void LCD::Render()
+void LCD::Present()
 {
-    if (const auto bus = m_Bus.lock())
+    if (glfwWindowShouldClose(m_Window) || glfwWindowShouldClose(m_WindowDebug))
     {
-        if (glfwWindowShouldClose(m_Window) || glfwWindowShouldClose(m_WindowDebug))
-        {
-            std::println("Window closed");
-            this->~LCD();
-            system("pause");
-            exit(1);
-        }
-
-        glfwMakeContextCurrent(m_Window);
-
-        std::vector<U8> m_ViewBuffer;
-
-        for (S32 ty = 17; ty >= 0; ty--)
-        {
-            for (S32 y = 7; y >= 0; y--)
-            {
-                for (S32 tx = 0; tx < 20; tx++)
-                {
-                    for (S32 x = 0; x < 8; x++)
-                    {
-                        U8 color = 0x00;
-
-                        for (auto i = 0; i < 2; i++)
-                        {
-                            U16 offsetY = bus->Read(i == 0 ? 0xFF42 : 0xFF4A);
-                            U16 offsetX = bus->Read(i == 0 ? 0xFF43 : 0xFF4B);
-
-                            U16 tileY = (offsetY / 8 + static_cast<U16>(ty)) % 32;
-                            U16 tileX = (offsetX / 8 + static_cast<U16>(tx)) % 32;
-
-                            U16 addressOffset = (i == 0 ? 0x9800 : 0x9C00) + static_cast<U16>(tileY * 32 + tileX);
-                            U16 tileIndex = bus->Read(addressOffset);
-                            U16 address = 0x8000 + tileIndex * 16 + static_cast<U16>(y * 2);
-                            U8 leftByte = bus->Read(address);
-                            U8 rightByte = bus->Read(address + 1);
-                            U8 lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
-                            U8 msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
-                            U8 pixel = static_cast<U8>(msb << 1) | lsb;
-
-                            color |= pixel * 85;
-                        }
-
-                        m_ViewBuffer.push_back(color);
-                        m_ViewBuffer.push_back(color);
-                        m_ViewBuffer.push_back(color);
-                    }
-                }
-            }
-        }
-
-        for (U16 address = 0xFE00; address < 0xFE9F; address += 4)
-        {
-            U8 ty = bus->Read(address);
-            U8 tx = bus->Read(address + 1);
-            U8 tileIndex = bus->Read(address + 2);
-            U8 flags = bus->Read(address + 3);
-
-            if (ty == 0 || tx == 0 || ty >= 160 || tx >= 168) continue;
-
-            U8 LCDC = bus->Read(0xFF40);
-            bool longTile = LCDC & 0x04;
-            
-            for (S8 j = 7; j >= 0; j--)
-            {
-                for (S8 i = 0; i < 8; i++)
-                {
-                    U8 y = static_cast<U8>(ty + j);
-                    U8 x = static_cast<U8>(tx + i);
-
-                    if (x < 8 || x >= 160 || y < 16 || y >= 144) continue;
-
-                    U32 index = ((y - 16) * 160 + (x - 8)) * 3;
-                    U8 tile = bus->Read(0x8000 + (longTile ? tileIndex & 0xFE : tileIndex));
-
-                    U16 address = 0x8000 + tile * 16 + static_cast<U16>(j * 2);
-                    U8 leftByte = bus->Read(address);
-                    U8 rightByte = bus->Read(address + 1);
-                    U8 lsb = (leftByte >> static_cast<U8>(7 - i)) & 0x01;
-                    U8 msb = (rightByte >> static_cast<U8>(7 - i)) & 0x01;
-
-                    U8 pixel = static_cast<U8>(msb << 1) | lsb;
+        std::println("Window closed");
+        this->~LCD();
+        system("pause");
+        exit(1);
+    }
 
-                    U8 color = pixel * 85;
-                    
-                    m_ViewBuffer[index] |= color;
-                    m_ViewBuffer[index + 1] |= color;
-                    m_ViewBuffer[index + 2] |= color;
-                }
-            }
-        }
+    glfwMakeContextCurrent(m_Window);
 
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 160, 144, GL_RGB, GL_UNSIGNED_BYTE, m_ViewBuffer.data());
+    // The PPU's finished frame goes up as is, a byte per pixel
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PPU::SCREEN_WIDTH, PPU::SCREEN_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, m_PPU.Frame().data());
 
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, m_Texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_Texture);
 
-        glUseProgram(m_ShaderProgram);
-        glBindVertexArray(m_VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glUseProgram(m_ShaderProgram);
+    glBindVertexArray(m_VAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
-        glfwSwapBuffers(m_Window);
-        glfwPollEvents();
+    glfwSwapBuffers(m_Window);
+    glfwPollEvents();
 
-        glfwMakeContextCurrent(m_WindowDebug);
+    glfwMakeContextCurrent(m_WindowDebug);
 
-        std::vector<U8> m_ViewBufferDebug;
+    const TileCache& tiles = m_PPU.Tiles();
 
-        for (S32 ty = 23; ty >= 0; ty--)
+    // Tiles 0-127, 128-255 and 256-383 are outlined in red, green and blue, bottom row first
+    Size i = 0;
+    for (S32 ty = 23; ty >= 0; ty--)
+    {
+        for (S32 y = 7; y >= 0; y--)
         {
-            for (S32 y = 7; y >= 0; y--)
+            for (S32 tx = 0; tx < 16; tx++)
             {
-                for (S32 tx = 0; tx < 16; tx++)
+                for (S32 x = 0; x < 8; x++, i += 3)
                 {
-                    for (S32 x = 0; x < 8; x++)
+                    const S32 area = ty / 8;
+                    const bool border = (tx == 0 && x == 0) || (tx == 15 && x == 7) ||
+                        (y == 7 && ty % 8 == 7) || (y == 0 && ty % 8 == 0);
+
+                    if (border)
                     {
-                        if (tx == 0 && x == 0 || (tx == 15 && x == 7))
-                        {
-                            if (ty < 8)
-                            {
-                                m_ViewBufferDebug.push_back(255);
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(0);
-                            }
-                            else if (ty < 16)
-                            {
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(255);
-                                m_ViewBufferDebug.push_back(0);
-                            }
-                            else
-                            {
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(255);
-                            }
-                            continue;
-                        }
-                        else if (y == 7)
-                        {
-                            if (ty == 7)
-                            {
-                                m_ViewBufferDebug.push_back(255);
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(0);
-                                continue;
-                            }
-                            else if (ty == 15)
-                            {
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(255);
-                                m_ViewBufferDebug.push_back(0);
-                                continue;
-                            }
-                            else if (ty == 23)
-                            {
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(255);
-                                continue;
-                            }
-                        }
-                        else if (y == 0)
-                        {
-                            if (ty == 0)
-                            {
-                                m_ViewBufferDebug.push_back(255);
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(0);
-                                continue;
-                            }
-                            else if (ty == 8)
-                            {
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(255);
-                                m_ViewBufferDebug.push_back(0);
-                                continue;
-                            }
-                            else if (ty == 16)
-                            {
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(0);
-                                m_ViewBufferDebug.push_back(255);
-                                continue;
-                            }
-                        }
-
-                        U16 byteStride = static_cast<U16>(ty * 16 + tx) * 16;
-                        U16 address = 0x8000 + byteStride + static_cast<U16>(y * 2);
-
-                        U8 leftByte = bus->Read(address);
-                        U8 rightByte = bus->Read(address + 1);
-
-                        U8 lsb = (leftByte >> static_cast<U8>(7 - x)) & 0x01;
-                        U8 msb = (rightByte >> static_cast<U8>(7 - x)) & 0x01;
-
-                        U8 pixel = static_cast<U8>(msb << 1) | lsb;
-
-                        m_ViewBufferDebug.push_back(pixel * 85);
-                        m_ViewBufferDebug.push_back(pixel * 85);
-                        m_ViewBufferDebug.push_back(pixel * 85);
+                        m_ViewBufferDebug[i] = area == 0 ? 255 : 0;
+                        m_ViewBufferDebug[i + 1] = area == 1 ? 255 : 0;
+                        m_ViewBufferDebug[i + 2] = area == 2 ? 255 : 0;
+                        continue;
                     }
+
+                    const U8 shade = tiles.Row(static_cast<Size>(ty * 16 + tx), static_cast<U8>(y))[x] * 85;
+                    m_ViewBufferDebug[i] = shade;
+                    m_ViewBufferDebug[i + 1] = shade;
+                    m_ViewBufferDebug[i + 2] = shade;
                 }
             }
         }
+    }
 
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 128, 192, GL_RGB, GL_UNSIGNED_BYTE, m_ViewBufferDebug.data());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DEBUG_WIDTH, DEBUG_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, m_ViewBufferDebug.data());
 
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, m_TextureDebug);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_TextureDebug);
 
-        glUseProgram(m_ShaderProgramDebug);
-        glBindVertexArray(m_VAODebug);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glUseProgram(m_ShaderProgramDebug);
+    glBindVertexArray(m_VAODebug);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
-        glfwSwapBuffers(m_WindowDebug);
-        glfwPollEvents();
-    }
+    glfwSwapBuffers(m_WindowDebug);
+    glfwPollEvents();
 }
@@ -1,23 +1,39 @@
 #pragma once
 
+#include <array>
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-#include "Bus.hpp"
+#include "PPU.hpp"
 
+// Presents the frames the PPU finished, plus a debug view of the tiles in video memory
 class LCD
 {
 public:
-    LCD(const std::shared_ptr<Bus>& bus);
+    LCD(const PPU& ppu);
     ~LCD();
 
-    void Render();
+    void Present();
+
+private:
+    // The tile view: 16 x 24 tiles of 8 x 8 pixels
+    static constexpr U32 DEBUG_WIDTH = 128;
+    static constexpr U32 DEBUG_HEIGHT = 192;
+
+    // RGB of shades 0 (lightest) to 3, looked up by the fragment shader
+    static inline constexpr float k_Palette[] = {
+        1.0f, 1.0f, 1.0f,
+        2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f,
+        1.0f / 3.0f, 1.0f / 3.0f, 1.0f / 3.0f,
+        0.0f, 0.0f, 0.0f
+    };
 
 private:
     GLFWwindow* m_Window;
     GLFWwindow* m_WindowDebug;
     
-    std::weak_ptr<Bus> m_Bus;
+    const PPU& m_PPU;
 
     unsigned int m_VAO = 0;
     unsigned int m_VBO = 0;
@@ -30,4 +46,7 @@ private:
     unsigned int m_EBODebug = 0;
     unsigned int m_ShaderProgramDebug = 0;
     unsigned int m_TextureDebug = 0;
+
+    // Rewritten in place on every present
+    std::array<U8, DEBUG_WIDTH * DEBUG_HEIGHT * 3> m_ViewBufferDebug {};
 };
@@ -0,0 +1,244 @@
+#include "PPU.hpp"
+
+#include <algorithm>
+
+#include "PixelDecoder.hpp"
+
+PPU::PPU(Bus& bus, Scheduler& scheduler) : m_Bus(bus), m_Scheduler(scheduler)
+{
+    m_Scheduler.Register(Scheduler::Event::PPU, [this](U64 timestamp) { Advance(timestamp); });
+    m_Bus.SetTileCache(&m_Tiles);
+
+    m_Bus.OnWrite(0xFF40, [this](Byte value) { Control(value); });
+    m_Bus.OnWrite(0xFF41, [this](Byte) { UpdateInterruptLine(); });
+    m_Bus.OnWrite(0xFF45, [this](Byte) { CompareLine(); });
+}
+
+U64 PPU::NextFrame() const
+{
+    if (!m_Enabled) return Scheduler::NEVER;
+
+    const U32 LY = m_Bus.IO(0xFF44);
+    const U32 lines = LY < SCREEN_HEIGHT ? SCREEN_HEIGHT - LY : LINES - LY + SCREEN_HEIGHT;
+    return m_LineStart + lines * LINE_CYCLES;
+}
+
+void PPU::Control(Byte value)
+{
+    const bool enabled = value & 0x80;
+    if (enabled == m_Enabled) return;
+    m_Enabled = enabled;
+
+    m_Bus.IO(0xFF44) = 0;
+    m_WindowLine = 0;
+
+    if (enabled)
+    {
+        // The first frame starts right away with the OAM scan of line 0
+        BeginLine(m_Scheduler.Now());
+        return;
+    }
+
+    // A switched off LCD shows nothing, holds LY at 0 and reports HBlank
+    m_Scheduler.Cancel(Scheduler::Event::PPU);
+    SetMode(Mode::HBlank);
+    CompareLine();
+
+    m_Framebuffers[m_Back].fill(0);
+    FinishFrame();
+}
+
+void PPU::Advance(U64 timestamp)
+{
+    switch (m_Mode)
+    {
+    case Mode::OAMScan:
+        SetMode(Mode::Drawing);
+        DrawLine();
+        m_Scheduler.Schedule(Scheduler::Event::PPU, m_LineStart + OAM_SCAN_CYCLES + DRAWING_CYCLES);
+        break;
+    case Mode::Drawing:
+        SetMode(Mode::HBlank);
+        m_Scheduler.Schedule(Scheduler::Event::PPU, m_LineStart + LINE_CYCLES);
+        break;
+    case Mode::HBlank:
+    case Mode::VBlank:
+        m_Bus.IO(0xFF44) = static_cast<U8>((m_Bus.IO(0xFF44) + 1) % LINES);
+        BeginLine(timestamp);
+        break;
+    }
+}
+
+void PPU::BeginLine(U64 timestamp)
+{
+    m_LineStart = timestamp;
+    const U8 LY = m_Bus.IO(0xFF44);
+    CompareLine();
+
+    if (LY < SCREEN_HEIGHT)
+    {
+        if (LY == 0) m_WindowLine = 0;
+        SetMode(Mode::OAMScan);
+        m_Scheduler.Schedule(Scheduler::Event::PPU, m_LineStart + OAM_SCAN_CYCLES);
+        return;
+    }
+
+    if (LY == SCREEN_HEIGHT)
+    {
+        SetMode(Mode::VBlank);
+        m_Bus.RequestInterrupt(0x01);
+        FinishFrame();
+    }
+    m_Scheduler.Schedule(Scheduler::Event::PPU, m_LineStart + LINE_CYCLES);
+}
+
+void PPU::FinishFrame()
+{
+    // Keeps the tiles current for the debug view as well
+    m_Tiles.Update(m_Bus.VideoRAM());
+
+    m_Back ^= 1;
+    m_FrameCount++;
+}
+
+void PPU::SetMode(Mode mode)
+{
+    m_Mode = mode;
+
+    Byte& STAT = m_Bus.IO(0xFF41);
+    STAT = (STAT & ~0x03) | static_cast<Byte>(mode);
+    UpdateInterruptLine();
+}
+
+void PPU::CompareLine()
+{
+    Byte& STAT = m_Bus.IO(0xFF41);
+    STAT = m_Bus.IO(0xFF44) == m_Bus.IO(0xFF45) ? STAT | 0x04 : STAT & ~0x04;
+    UpdateInterruptLine();
+}
+
+void PPU::UpdateInterruptLine()
+{
+    const Byte STAT = m_Bus.IO(0xFF41);
+    const bool line = m_Enabled && (((STAT & 0x40) && (STAT & 0x04)) ||
+                                    ((STAT & 0x08) && m_Mode == Mode::HBlank) ||
+                                    ((STAT & 0x10) && m_Mode == Mode::VBlank) ||
+                                    ((STAT & 0x20) && m_Mode == Mode::OAMScan));
+
+    if (line && !m_InterruptLine) m_Bus.RequestInterrupt(0x02);
+    m_InterruptLine = line;
+}
+
+Size PPU::TileNumber(Byte LCDC, U8 tile)
+{
+    // Tiles 0-255 from 0x8000, or -128-127 around 0x9000
+    return LCDC & 0x10 ? tile : 256 + static_cast<S8>(tile);
+}
+
+void PPU::DrawLine()
+{
+    const U8 LY = m_Bus.IO(0xFF44);
+    const Byte LCDC = m_Bus.IO(0xFF40);
+    const U8 SCY = m_Bus.IO(0xFF42);
+    const U8 SCX = m_Bus.IO(0xFF43);
+    const U8 WY = m_Bus.IO(0xFF4A);
+    const U8 WX = m_Bus.IO(0xFF4B);
+    const auto vram = m_Bus.VideoRAM();
+
+    m_Tiles.Update(vram);
+    U8* line = m_Framebuffers[m_Back].data() + LY * SCREEN_WIDTH;
+
+    // Background and window color numbers before the palette, which decide sprite priority
+    std::array<U8, SCREEN_WIDTH> colors {};
+
+    // Copies the row of consecutive tiles from `map` starting at pixel `mapX` into [x, SCREEN_WIDTH)
+    const auto drawTiles = [&](Size map, U8 mapY, U8 mapX, U32 x) {
+        while (x < SCREEN_WIDTH)
+        {
+            const U8 tile = vram[map + (mapY / 8) * 32 + mapX / 8];
+            const U8* row = m_Tiles.Row(TileNumber(LCDC, tile), mapY % 8);
+            const U32 run = std::min<U32>(8 - mapX % 8, SCREEN_WIDTH - x);
+
+            std::copy_n(row + mapX % 8, run, colors.data() + x);
+            x += run;
+            mapX = static_cast<U8>(mapX + run);
+        }
+    };
+
+    if (LCDC & 0x01)
+    {
+        drawTiles(LCDC & 0x08 ? 0x1C00 : 0x1800, static_cast<U8>(SCY + LY), SCX, 0);
+
+        if ((LCDC & 0x20) && LY >= WY && WX < SCREEN_WIDTH + 7)
+        {
+            // The window's left edge may be off screen by up to 7 pixels
+            const U8 skipped = WX < 7 ? 7 - WX : 0;
+            drawTiles(LCDC & 0x40 ? 0x1C00 : 0x1800, m_WindowLine, skipped, WX + skipped - 7);
+            m_WindowLine++;
+        }
+    }
+
+    PixelDecoder::ApplyPalette(colors.data(), SCREEN_WIDTH, Palette(m_Bus.IO(0xFF47)), line);
+
+    if (!(LCDC & 0x02)) return;
+
+    // OAM scan: the first ten sprites in OAM order that cover this line
+    const U8 height = LCDC & 0x04 ? 16 : 8;
+    const auto oam = m_Bus.OAM();
+
+    std::array<Size, MAX_SPRITES_PER_LINE> sprites {};
+    Size count = 0;
+    for (Size sprite = 0; sprite < MAX_SPRITES && count < MAX_SPRITES_PER_LINE; sprite++)
+    {
+        const U8 y = oam[sprite * 4];
+        if (LY + 16 >= y && LY + 16 < y + height) sprites[count++] = sprite;
+    }
+
+    // The lower X coordinate wins where sprites overlap, then the earlier one in OAM
+    std::stable_sort(sprites.begin(), sprites.begin() + count,
+        [&oam](Size a, Size b) { return oam[a * 4 + 1] < oam[b * 4 + 1]; });
+
+    const std::array<std::array<U8, 4>, 2> OBP = { Palette(m_Bus.IO(0xFF48)), Palette(m_Bus.IO(0xFF49)) };
+
+    std::array<bool, SCREEN_WIDTH> covered {};
+    for (Size i = 0; i < count; i++)
+    {
+        const Byte* sprite = oam.data() + sprites[i] * 4;
+        const U8 y = sprite[0];
+        const U8 x = sprite[1];
+        const Byte flags = sprite[3];
+        const auto& palette = OBP[(flags >> 4) & 0x01];
+
+        // 8x16 sprites are two consecutive tiles starting at an even one
+        U8 row = static_cast<U8>(LY + 16 - y);
+        if (flags & 0x40) row = height - 1 - row;
+        const U8 tile = height == 16 ? (sprite[2] & 0xFE) + row / 8 : sprite[2];
+
+        // The cached row in screen order, and its shades
+        const U8* cached = m_Tiles.Row(tile, row % 8);
+        std::array<U8, 8> pixels;
+        std::array<U8, 8> shades;
+        if (flags & 0x20) std::reverse_copy(cached, cached + 8, pixels.begin());
+        else std::copy_n(cached, 8, pixels.begin());
+        PixelDecoder::ApplyPalette(pixels.data(), pixels.size(), palette, shades.data());
+
+        for (U8 column = 0; column < 8; column++)
+        {
+            const S32 screenX = x - 8 + column;
+            if (screenX < 0 || screenX >= static_cast<S32>(SCREEN_WIDTH) || covered[screenX]) continue;
+            if (pixels[column] == 0) continue;
+
+            // Even when hidden behind the background, an opaque pixel hides lower priority sprites
+            covered[screenX] = true;
+            if ((flags & 0x80) && colors[screenX] != 0) continue;
+
+            line[screenX] = shades[column];
+        }
+    }
+}
+
+std::array<U8, 4> PPU::Palette(Byte value)
+{
+    return { static_cast<U8>(value & 0x03), static_cast<U8>((value >> 2) & 0x03),
+             static_cast<U8>((value >> 4) & 0x03), static_cast<U8>((value >> 6) & 0x03) };
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <array>
+
+#include "Bus.hpp"
+#include "Scheduler.hpp"
+#include "TileCache.hpp"
+#include "Utility/Types.hpp"
+
+// Picture processing unit. Every visible line steps through OAM scan, drawing and HBlank as
+// scheduled events, followed by ten lines of VBlank; LY, STAT and the VBlank/STAT interrupts change
+// exactly at those points. A line is drawn into the back framebuffer when drawing starts and the
+// buffers swap at VBlank, so whoever presents frames only ever sees finished ones.
+class PPU
+{
+public:
+    static constexpr U32 SCREEN_WIDTH = 160;
+    static constexpr U32 SCREEN_HEIGHT = 144;
+
+    static constexpr U32 LINE_CYCLES = 456;
+    static constexpr U32 LINES = 154;
+    static constexpr U32 FRAME_CYCLES = LINE_CYCLES * LINES;
+    static constexpr U32 OAM_SCAN_CYCLES = 80;
+    static constexpr U32 DRAWING_CYCLES = 172;
+
+    static constexpr Size MAX_SPRITES = 40;
+    static constexpr Size MAX_SPRITES_PER_LINE = 10;
+
+    // One shade per pixel (0 lightest, 3 darkest), rows from the top
+    using Framebuffer = std::array<U8, SCREEN_WIDTH * SCREEN_HEIGHT>;
+
+    // STAT bits 0-1
+    enum class Mode : U8
+    {
+        HBlank = 0,
+        VBlank = 1,
+        OAMScan = 2,
+        Drawing = 3
+    };
+
+public:
+    PPU(Bus& bus, Scheduler& scheduler);
+
+    // The last finished frame, and how many frames have been finished so far
+    const Framebuffer& Frame() const { return m_Framebuffers[m_Back ^ 1]; }
+    U64 FrameCount() const { return m_FrameCount; }
+
+    // Decoded VRAM tiles as of the last line drawn or frame finished
+    const TileCache& Tiles() const { return m_Tiles; }
+
+    // When the frame being drawn will be finished, NEVER while the LCD is off
+    U64 NextFrame() const;
+
+private:
+    // LCDC (0xFF40) writes switch the LCD on and off
+    void Control(Byte value);
+
+    void Advance(U64 timestamp);
+    void BeginLine(U64 timestamp);
+    void FinishFrame();
+
+    void SetMode(Mode mode);
+    void CompareLine();
+    void UpdateInterruptLine();
+
+    void DrawLine();
+
+    // Tile cache index of a background or window tile number under the LCDC addressing mode
+    static Size TileNumber(Byte LCDC, U8 tile);
+
+    // Shade of each color number under a BGP/OBP0/OBP1 value
+    static std::array<U8, 4> Palette(Byte value);
+
+private:
+    Bus& m_Bus;
+    Scheduler& m_Scheduler;
+
+    bool m_Enabled = false;
+    Mode m_Mode = Mode::HBlank;
+    U64 m_LineStart = 0;
+
+    // STAT interrupts fire on the rising edge of the OR of all enabled conditions
+    bool m_InterruptLine = false;
+
+    // The window has its own line counter that only advances on lines it was drawn on
+    U8 m_WindowLine = 0;
+
+    TileCache m_Tiles;
+
+    std::array<Framebuffer, 2> m_Framebuffers {};
+    U8 m_Back = 0;
+    U64 m_FrameCount = 0;
+};
@@ -0,0 +1,268 @@
+#include "PixelDecoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <print>
+#include <random>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define PIXEL_DECODER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+PixelDecoder::Implementation PixelDecoder::s_Implementation = PixelDecoder::Select(PixelDecoder::Supported());
+
+PixelDecoder::Level PixelDecoder::Supported()
+{
+#ifdef PIXEL_DECODER_X86
+#ifdef _MSC_VER
+    // AVX2 also needs the OS to save the YMM registers
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7)
+    {
+        __cpuid(info, 1);
+        const bool osSavesYMM = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x06) == 0x06;
+
+        __cpuidex(info, 7, 0);
+        if (osSavesYMM && (info[1] & (1 << 5))) return Level::AVX2;
+    }
+#else
+    if (__builtin_cpu_supports("avx2")) return Level::AVX2;
+#endif
+    // Part of x86-64 itself
+    return Level::SSE2;
+#else
+    return Level::Scalar;
+#endif
+}
+
+const char* PixelDecoder::Name(Level level)
+{
+    switch (level)
+    {
+    case Level::SSE2: return "SSE2";
+    case Level::AVX2: return "AVX2";
+    default: return "Scalar";
+    }
+}
+
+void PixelDecoder::Use(Level level)
+{
+    s_Implementation = Select(std::min(level, Supported()));
+}
+
+PixelDecoder::Implementation PixelDecoder::Select(Level level)
+{
+    switch (level)
+    {
+    case Level::SSE2: return { level, DecodeRowsSSE2, ApplyPaletteSSE2 };
+    case Level::AVX2: return { level, DecodeRowsAVX2, ApplyPaletteAVX2 };
+    default: return { Level::Scalar, DecodeRowsScalar, ApplyPaletteScalar };
+    }
+}
+
+#pragma region Scalar
+void PixelDecoder::DecodeRowsScalar(const Byte* planes, Size rows, bool flip, U8* pixels)
+{
+    for (Size row = 0; row < rows; row++)
+    {
+        const Byte low = planes[row * 2];
+        const Byte high = planes[row * 2 + 1];
+
+        for (U8 x = 0; x < 8; x++)
+        {
+            const U8 bit = flip ? x : 7 - x;
+            pixels[row * 8 + x] = static_cast<U8>(((high >> bit) & 0x01) << 1 | ((low >> bit) & 0x01));
+        }
+    }
+}
+
+void PixelDecoder::ApplyPaletteScalar(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades)
+{
+    for (Size i = 0; i < count; i++) shades[i] = palette[colors[i]];
+}
+#pragma endregion
+
+#ifdef PIXEL_DECODER_X86
+#pragma region SSE2
+void PixelDecoder::DecodeRowsSSE2(const Byte* planes, Size rows, bool flip, U8* pixels)
+{
+    // One bit per lane, leftmost pixel in the lowest lane; the low plane in the lower 8 lanes of a
+    // row and the high plane in the upper 8, where a set bit counts 1 and 2 respectively
+    const __m128i bits = _mm_set1_epi64x(static_cast<long long>(flip ? 0x8040201008040201 : 0x0102040810204080));
+    const __m128i weights = _mm_set_epi64x(0x0202020202020202, 0x0101010101010101);
+
+    const auto expand = [&](__m128i row) {
+        const __m128i set = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(row, bits), bits), weights);
+        return _mm_or_si128(set, _mm_srli_si128(set, 8));
+    };
+
+    Size row = 0;
+    for (; row + 8 <= rows; row += 8)
+    {
+        // Spreads each plane byte over 8 lanes: rows 0-3 and 4-7, then pairs of rows, then single rows
+        const __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes + row * 2));
+        const __m128i low = _mm_unpacklo_epi8(source, source);
+        const __m128i high = _mm_unpackhi_epi8(source, source);
+        const __m128i quads[4] = {
+            _mm_unpacklo_epi16(low, low), _mm_unpackhi_epi16(low, low),
+            _mm_unpacklo_epi16(high, high), _mm_unpackhi_epi16(high, high)
+        };
+
+        for (Size pair = 0; pair < 4; pair++)
+        {
+            const __m128i first = expand(_mm_unpacklo_epi32(quads[pair], quads[pair]));
+            const __m128i second = expand(_mm_unpackhi_epi32(quads[pair], quads[pair]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + (row + pair * 2) * 8), _mm_unpacklo_epi64(first, second));
+        }
+    }
+
+    DecodeRowsScalar(planes + row * 2, rows - row, flip, pixels + row * 8);
+}
+
+void PixelDecoder::ApplyPaletteSSE2(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades)
+{
+    // No byte shuffle before SSSE3, so every color number selects its shade through a mask
+    __m128i numbers[4];
+    __m128i entries[4];
+    for (U8 color = 0; color < 4; color++)
+    {
+        numbers[color] = _mm_set1_epi8(static_cast<char>(color));
+        entries[color] = _mm_set1_epi8(static_cast<char>(palette[color]));
+    }
+
+    Size i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+        __m128i result = _mm_setzero_si128();
+        for (U8 color = 0; color < 4; color++)
+        {
+            result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(source, numbers[color]), entries[color]));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(shades + i), result);
+    }
+
+    ApplyPaletteScalar(colors + i, count - i, palette, shades + i);
+}
+#pragma endregion
+
+#pragma region AVX2
+TARGET_AVX2 void PixelDecoder::DecodeRowsAVX2(const Byte* planes, Size rows, bool flip, U8* pixels)
+{
+    // Four rows per vector, two per 128-bit lane: every lane gathers its rows' plane bytes with a
+    // shuffle, 8 copies each
+    const __m256i bits = _mm256_set1_epi64x(static_cast<long long>(flip ? 0x8040201008040201 : 0x0102040810204080));
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i lowFirst = _mm256_set_epi64x(0x0606060606060606, 0x0404040404040404, 0x0202020202020202, 0x0000000000000000);
+    const __m256i lowSecond = _mm256_add_epi8(lowFirst, _mm256_set1_epi8(8));
+
+    Size row = 0;
+    for (; row + 8 <= rows; row += 8)
+    {
+        const __m256i source = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes + row * 2)));
+
+        for (Size half = 0; half < 2; half++)
+        {
+            const __m256i select = half == 0 ? lowFirst : lowSecond;
+            const __m256i low = _mm256_shuffle_epi8(source, select);
+            const __m256i high = _mm256_shuffle_epi8(source, _mm256_add_epi8(select, one));
+
+            const __m256i lowSet = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits), one);
+            const __m256i highSet = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits), two);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + (row + half * 4) * 8), _mm256_or_si256(lowSet, highSet));
+        }
+    }
+
+    DecodeRowsScalar(planes + row * 2, rows - row, flip, pixels + row * 8);
+}
+
+TARGET_AVX2 void PixelDecoder::ApplyPaletteAVX2(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades)
+{
+    // Color numbers index the palette directly as shuffle controls
+    const U32 packed = palette[0] | palette[1] << 8 | palette[2] << 16 | palette[3] << 24;
+    const __m256i table = _mm256_set1_epi32(static_cast<int>(packed));
+
+    Size i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        const __m256i source = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(shades + i), _mm256_shuffle_epi8(table, source));
+    }
+
+    ApplyPaletteScalar(colors + i, count - i, palette, shades + i);
+}
+#pragma endregion
+#else
+void PixelDecoder::DecodeRowsSSE2(const Byte* planes, Size rows, bool flip, U8* pixels) { DecodeRowsScalar(planes, rows, flip, pixels); }
+void PixelDecoder::ApplyPaletteSSE2(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades) { ApplyPaletteScalar(colors, count, palette, shades); }
+void PixelDecoder::DecodeRowsAVX2(const Byte* planes, Size rows, bool flip, U8* pixels) { DecodeRowsScalar(planes, rows, flip, pixels); }
+void PixelDecoder::ApplyPaletteAVX2(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades) { ApplyPaletteScalar(colors, count, palette, shades); }
+#endif
+
+void PixelDecoder::Benchmark()
+{
+    // All of tile data, decoded the way TileCache does it, and a frame's worth of palette lookups
+    constexpr Size ROWS = 384 * 8;
+    constexpr Size PIXELS = 160 * 144;
+    constexpr Size ITERATIONS = 2000;
+
+    std::mt19937 random(0x2BB);
+    std::vector<Byte> planes(ROWS * 2);
+    std::vector<U8> colors(PIXELS);
+    for (auto& byte : planes) byte = static_cast<Byte>(random());
+    for (auto& color : colors) color = static_cast<U8>(random() & 0x03);
+    const std::array<U8, 4> palette = { 0, 3, 1, 2 };
+
+    const Implementation previous = s_Implementation;
+    std::vector<U8> expectedPixels(ROWS * 8), expectedShades(PIXELS);
+    DecodeRowsScalar(planes.data(), ROWS, true, expectedPixels.data());
+    ApplyPaletteScalar(colors.data(), PIXELS, palette, expectedShades.data());
+
+    const auto time = [](auto&& work) {
+        const auto start = std::chrono::steady_clock::now();
+        for (Size i = 0; i < ITERATIONS; i++) work();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+    };
+
+    double scalarDecode = 0.0, scalarPalette = 0.0;
+    for (U8 level = 0; level <= static_cast<U8>(Supported()); level++)
+    {
+        s_Implementation = Select(static_cast<Level>(level));
+
+        std::vector<U8> pixels(ROWS * 8), shades(PIXELS);
+        volatile U8 sink = 0;
+        const double decode = time([&] {
+            DecodeRows(planes.data(), ROWS, false, pixels.data());
+            sink = pixels[random() % pixels.size()];
+        });
+        const double lookup = time([&] {
+            ApplyPalette(colors.data(), PIXELS, palette, shades.data());
+            sink = shades[random() % shades.size()];
+        });
+
+        DecodeRows(planes.data(), ROWS, true, pixels.data());
+        const bool matches = pixels == expectedPixels && shades == expectedShades;
+
+        if (level == 0)
+        {
+            scalarDecode = decode;
+            scalarPalette = lookup;
+        }
+
+        std::println("{:<6} decode {:8.0f} ns/tile data ({:4.1f}x)  palette {:8.0f} ns/frame ({:4.1f}x){}",
+            Name(static_cast<Level>(level)), decode, scalarDecode / decode, lookup, scalarPalette / lookup,
+            matches ? "" : "  MISMATCH");
+    }
+
+    s_Implementation = previous;
+}
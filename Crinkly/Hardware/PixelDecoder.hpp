@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+
+#include "Utility/Types.hpp"
+
+// Vectorized 2bpp tile row decoding and palette application. The widest implementation the host
+// supports (AVX2, SSE2, or plain scalar code) is picked once at startup; all of them produce the
+// same output.
+class PixelDecoder
+{
+public:
+    enum class Level : U8
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+public:
+    // Expands `rows` tile rows, each a low and a high bitplane byte, to 8 color numbers (0-3) per
+    // row with the leftmost pixel first, or the rightmost one when `flip` is set
+    static void DecodeRows(const Byte* planes, Size rows, bool flip, U8* pixels) { s_Implementation.decodeRows(planes, rows, flip, pixels); }
+
+    // Maps `count` color numbers to the shades a BGP/OBP0/OBP1 palette assigns them
+    static void ApplyPalette(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades)
+    {
+        s_Implementation.applyPalette(colors, count, palette, shades);
+    }
+
+    static Level Supported();
+    static Level Current() { return s_Implementation.level; }
+    static const char* Name(Level level);
+
+    // Switches to `level`, which must not exceed Supported()
+    static void Use(Level level);
+
+    // Times every supported level against the scalar code on random tile data and prints the results
+    static void Benchmark();
+
+private:
+    using DecodeRowsFunction = void (*)(const Byte* planes, Size rows, bool flip, U8* pixels);
+    using ApplyPaletteFunction = void (*)(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades);
+
+    struct Implementation
+    {
+        Level level;
+        DecodeRowsFunction decodeRows;
+        ApplyPaletteFunction applyPalette;
+    };
+
+    static Implementation Select(Level level);
+
+    static void DecodeRowsScalar(const Byte* planes, Size rows, bool flip, U8* pixels);
+    static void ApplyPaletteScalar(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades);
+    static void DecodeRowsSSE2(const Byte* planes, Size rows, bool flip, U8* pixels);
+    static void ApplyPaletteSSE2(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades);
+    static void DecodeRowsAVX2(const Byte* planes, Size rows, bool flip, U8* pixels);
+    static void ApplyPaletteAVX2(const U8* colors, Size count, const std::array<U8, 4>& palette, U8* shades);
+
+private:
+    static Implementation s_Implementation;
+};
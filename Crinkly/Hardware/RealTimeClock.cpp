@@ -0,0 +1,104 @@
+#include "RealTimeClock.hpp"
+
+#include <chrono>
+
+RealTimeClock::RealTimeClock(const Scheduler& scheduler) : m_Scheduler(scheduler)
+{
+}
+
+void RealTimeClock::Latch(Byte value)
+{
+    if (m_LastLatch == 0x00 && value == 0x01) m_Latched = Current();
+    m_LastLatch = value;
+}
+
+void RealTimeClock::Write(U8 index, Byte value)
+{
+    Registers registers = Current();
+    registers[index] = value;
+
+    // Writing the seconds also restarts the current second
+    Set(registers, index == 0 ? 0 : Elapsed() % CYCLES_PER_SECOND);
+}
+
+void RealTimeClock::Load(std::span<const Byte> save)
+{
+    // A fresh save file is all zeros and leaves the clock at day 0
+    const U64 savedAt = LoadValue(save, 40, 8);
+    if (savedAt == 0) return;
+
+    Registers registers;
+    for (Size i = 0; i < registers.size(); i++)
+    {
+        registers[i] = static_cast<Byte>(LoadValue(save, i * 4, 4));
+        m_Latched[i] = static_cast<Byte>(LoadValue(save, 20 + i * 4, 4));
+    }
+    Set(registers, 0);
+
+    // The battery kept the clock running while the emulator was closed
+    const U64 now = HostTime();
+    if (!m_Halted && now > savedAt) m_Cycles += (now - savedAt) * CYCLES_PER_SECOND;
+}
+
+void RealTimeClock::Save(std::span<Byte> save) const
+{
+    const Registers registers = Current();
+    for (Size i = 0; i < registers.size(); i++)
+    {
+        SaveValue(save, i * 4, 4, registers[i]);
+        SaveValue(save, 20 + i * 4, 4, m_Latched[i]);
+    }
+    SaveValue(save, 40, 8, HostTime());
+}
+
+U64 RealTimeClock::Elapsed() const
+{
+    return m_Halted ? m_Cycles : m_Cycles + (m_Scheduler.Now() - m_Timestamp);
+}
+
+RealTimeClock::Registers RealTimeClock::Current() const
+{
+    const U64 seconds = Elapsed() / CYCLES_PER_SECOND;
+    const U64 days = seconds / SECONDS_PER_DAY;
+
+    // The day counter is 9 bits; overflowing it sets the carry, which stays until the game clears it
+    const bool carry = m_DayCarry || days >= MAX_DAYS;
+    const U64 day = days % MAX_DAYS;
+
+    return {
+        static_cast<Byte>(seconds % 60),
+        static_cast<Byte>(seconds / 60 % 60),
+        static_cast<Byte>(seconds / 3600 % 24),
+        static_cast<Byte>(day & 0xFF),
+        static_cast<Byte>((day >> 8) | (m_Halted ? 0x40 : 0x00) | (carry ? 0x80 : 0x00))
+    };
+}
+
+void RealTimeClock::Set(const Registers& registers, U64 subsecond)
+{
+    const U64 days = registers[3] | ((registers[4] & 0x01) << 8);
+    const U64 seconds = ((days * 24 + (registers[2] & 0x1F)) * 60 + (registers[1] & 0x3F)) * 60 + (registers[0] & 0x3F);
+
+    m_Cycles = seconds * CYCLES_PER_SECOND + subsecond;
+    m_Timestamp = m_Scheduler.Now();
+    m_Halted = registers[4] & 0x40;
+    m_DayCarry = registers[4] & 0x80;
+}
+
+U64 RealTimeClock::HostTime()
+{
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<U64>(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+}
+
+U64 RealTimeClock::LoadValue(std::span<const Byte> save, Size offset, Size length)
+{
+    U64 value = 0;
+    for (Size i = 0; i < length; i++) value |= static_cast<U64>(save[offset + i]) << (i * 8);
+    return value;
+}
+
+void RealTimeClock::SaveValue(std::span<Byte> save, Size offset, Size length, U64 value)
+{
+    for (Size i = 0; i < length; i++) save[offset + i] = static_cast<Byte>(value >> (i * 8));
+}
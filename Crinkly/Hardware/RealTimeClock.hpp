@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <span>
+
+#include "Scheduler.hpp"
+#include "Utility/Types.hpp"
+
+// MBC3 real-time clock. Nothing ticks: the clock is a cycle count taken at a known timestamp, and the
+// registers are only worked out when the game latches or writes them. It runs on emulated time, so it
+// keeps pace with fast-forward and pauses without drifting; only the time the emulator was closed is
+// taken from the host clock.
+class RealTimeClock
+{
+public:
+    static constexpr U64 CYCLES_PER_SECOND = 4'194'304;
+
+    // Appended to the .sav file: current and latched S, M, H, DL, DH as 32-bit values, then the Unix
+    // time of the save, the layout other emulators use as well
+    static constexpr Size SAVE_SIZE = 48;
+
+public:
+    explicit RealTimeClock(const Scheduler& scheduler);
+
+    // Writing 0x00 and then 0x01 to 0x6000-0x7FFF copies the running time into the readable registers
+    void Latch(Byte value);
+
+    // Index 0-4 selects S, M, H, DL, DH. Reads see the latched registers, writes set the running clock.
+    Byte Read(U8 index) const { return m_Latched[index]; }
+    void Write(U8 index, Byte value);
+
+    void Load(std::span<const Byte> save);
+    void Save(std::span<Byte> save) const;
+
+private:
+    static constexpr U64 SECONDS_PER_DAY = 24 * 60 * 60;
+    static constexpr U64 MAX_DAYS = 512;
+
+    using Registers = std::array<Byte, 5>;
+
+    U64 Elapsed() const;
+    Registers Current() const;
+    void Set(const Registers& registers, U64 subsecond);
+
+    // Little-endian fields of the save footer, and the Unix time in seconds
+    static U64 LoadValue(std::span<const Byte> save, Size offset, Size length);
+    static void SaveValue(std::span<Byte> save, Size offset, Size length, U64 value);
+    static U64 HostTime();
+
+private:
+    const Scheduler& m_Scheduler;
+
+    // Clock value in cycles as of m_Timestamp; it only moves on while not halted (DH bit 6)
+    U64 m_Cycles = 0;
+    U64 m_Timestamp = 0;
+    bool m_Halted = false;
+    bool m_DayCarry = false;
+
+    Byte m_LastLatch = 0xFF;
+    Registers m_Latched {};
+};
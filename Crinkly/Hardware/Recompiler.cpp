@@ -0,0 +1,883 @@
+#include "CPU.hpp"
+
+#ifdef RECOMPILER
+
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Recompiler::Recompiler()
+{
+#ifdef _WIN32
+    void* code = VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* code = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) code = nullptr;
+#endif
+
+    if (code == nullptr)
+    {
+        std::cerr << "Failed to allocate executable memory for the recompiler\n";
+        exit(1);
+    }
+
+    m_Code = static_cast<U8*>(code);
+    m_Used = 0;
+}
+
+Recompiler::~Recompiler()
+{
+#ifdef _WIN32
+    VirtualFree(m_Code, 0, MEM_RELEASE);
+#else
+    munmap(m_Code, CODE_BUFFER_SIZE);
+#endif
+}
+
+bool Recompiler::Compile(BlockCache::Block& block, const Environment& environment)
+{
+    const auto& instructions = block.instructions;
+    const Size count = static_cast<Size>(instructions.size());
+
+    Translation translation{ &block, &environment };
+    m_Buffer.clear();
+    m_Leave.clear();
+
+    // Every instruction starts at a fixed offset into the pass, only a taken jump adds cycles
+    U32 cycles = 0;
+    for (const auto& instruction : instructions)
+    {
+        const U8 opcode = instruction.opcode;
+        const bool conditional = opcode == 0x20 || opcode == 0x28 || opcode == 0x30 || opcode == 0x38 || (opcode & 0xE7) == 0xC2;
+
+        translation.offsets.push_back(cycles);
+        cycles += opcode == 0xCB ? environment.cyclesPrefixed[instruction.operands[0]] : environment.cycles[opcode];
+
+        U32 taken = 0;
+        if (IsTranslated(instruction)) taken = conditional ? environment.jumpTakenCycles : 0;
+        else if (BlockCache::EndsBlock(opcode)) taken = environment.maxTakenCycles;
+        translation.ends.push_back(cycles + taken);
+    }
+    translation.cycles = cycles;
+    block.entryCycles = translation.ends[0];
+
+    // Flag liveness, backwards: everything is live when the block is left
+    translation.live.resize(count);
+    U8 live = ALL_FLAGS;
+    for (Size i = count; i-- > 0;)
+    {
+        translation.live[i] = live;
+        live = (live & ~FlagsDefined(instructions[i])) | FlagsUsed(instructions[i]);
+    }
+
+    // Prologue: save the callee-saved registers, which then hold the guest registers
+    Emit({ 0x53 }); // push rbx
+    Emit({ 0x55 }); // push rbp
+    Emit({ 0x41, 0x54 }); // push r12
+    Emit({ 0x41, 0x55 }); // push r13
+    Emit({ 0x41, 0x56 }); // push r14
+    Emit({ 0x41, 0x57 }); // push r15
+    Emit({ 0x48, 0x83, 0xEC, static_cast<U8>(FRAME_SIZE) }); // sub rsp, FRAME_SIZE
+    Encode({ 0x8B }, STATE, ARGUMENTS[0], QWORD); // mov r15, cpu
+    Encode({ 0x89 }, ARGUMENTS[1], Memory{ RSP, BUDGET_SLOT }, DWORD); // mov [budget], budget
+    Encode({ 0xC7 }, 0, Memory{ STATE, environment.passCycles }, DWORD); // mov [passCycles], 0
+    Emit32(0);
+    ReloadRegisters(environment);
+
+    translation.loop = static_cast<Size>(m_Buffer.size());
+    for (Size i = 0; i < count; i++)
+    {
+        CheckBudget(translation, i);
+        Translate(translation, i);
+    }
+
+    // A block cut short by the instruction limit or a 16 KiB boundary falls through
+    const auto& last = instructions.back();
+    if (IsTranslated(last) && !BlockCache::EndsBlock(last.opcode))
+    {
+        Exit(environment, static_cast<Address>(block.start + block.length), cycles);
+    }
+
+    for (auto& cold : translation.cold)
+    {
+        Place(cold.entry);
+
+        if (cold.kind == ColdPath::Kind::Budget)
+        {
+            Exit(environment, instructions[cold.instruction].address, translation.offsets[cold.instruction]);
+            continue;
+        }
+
+        if (cold.kind == ColdPath::Kind::Invalidate)
+        {
+            const auto& instruction = instructions[cold.instruction];
+            Encode({ 0x8B }, ARGUMENTS[0], STATE, QWORD); // mov arg0, r15
+            Encode({ 0x8B }, ARGUMENTS[1], RCX, DWORD); // mov arg1, ecx
+            Call(reinterpret_cast<const void*>(environment.invalidate));
+
+            if (instruction.opcode == 0x22) Encode({ 0xFF }, 0, GUEST_HL, WORD); // inc r13w
+            if (instruction.opcode == 0x32) Encode({ 0xFF }, 1, GUEST_HL, WORD); // dec r13w
+
+            const Address next = static_cast<Address>(instruction.address + BlockCache::InstructionLength(instruction.opcode));
+            Exit(environment, next, translation.offsets[cold.instruction] + environment.cycles[instruction.opcode]);
+            continue;
+        }
+
+        SpillRegisters(environment);
+        CallStep(translation, cold.instruction);
+        ReloadRegisters(environment);
+
+        // Reads have no side effects that could end the block, writes may
+        if (cold.kind == ColdPath::Kind::Write)
+        {
+            Emit({ 0x84, 0xC0 }); // test al, al
+            JumpTo(cold.resume, NOT_EQUAL);
+            ExitAfterStep(environment, translation.offsets[cold.instruction]);
+        }
+        else
+        {
+            JumpTo(cold.resume);
+        }
+    }
+
+    // Epilogue: EAX holds the T-cycles taken
+    Place(m_Leave);
+    SpillRegisters(environment);
+    Emit({ 0x48, 0x83, 0xC4, static_cast<U8>(FRAME_SIZE) }); // add rsp, FRAME_SIZE
+    Emit({ 0x41, 0x5F }); // pop r15
+    Emit({ 0x41, 0x5E }); // pop r14
+    Emit({ 0x41, 0x5D }); // pop r13
+    Emit({ 0x41, 0x5C }); // pop r12
+    Emit({ 0x5D }); // pop rbp
+    Emit({ 0x5B }); // pop rbx
+    Emit({ 0xC3 }); // ret
+
+    if (m_Used + m_Buffer.size() > CODE_BUFFER_SIZE) return false;
+
+    U8* code = m_Code + m_Used;
+    Protect(code, static_cast<Size>(m_Buffer.size()), false);
+    std::memcpy(code, m_Buffer.data(), m_Buffer.size());
+    Protect(code, static_cast<Size>(m_Buffer.size()), true);
+    m_Used += (static_cast<Size>(m_Buffer.size()) + 15) & ~15u;
+
+    block.native = reinterpret_cast<BlockCache::NativeBlock>(code);
+    return true;
+}
+
+void Recompiler::Protect(U8* code, Size size, bool executable)
+{
+    // Protection works on whole pages, neighbouring translations are flipped along with this one
+#ifdef _WIN32
+    DWORD previous;
+    const bool protectedPages = VirtualProtect(code, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous);
+    if (protectedPages && executable) FlushInstructionCache(GetCurrentProcess(), code, size);
+#else
+    const Size pageSize = static_cast<Size>(sysconf(_SC_PAGESIZE));
+    U8* first = m_Code + (code - m_Code) / pageSize * pageSize;
+    const bool protectedPages = mprotect(first, code + size - first, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+
+    if (!protectedPages)
+    {
+        std::cerr << "Failed to change the protection of the recompiler code buffer\n";
+        exit(1);
+    }
+}
+
+#pragma region Translation
+
+void Recompiler::Translate(Translation& translation, Size index)
+{
+    const auto& instruction = translation.block->instructions[index];
+    const Environment& environment = *translation.environment;
+    const U8 opcode = instruction.opcode;
+    const U16 imm16 = static_cast<U16>(instruction.operands[0] | (instruction.operands[1] << 8));
+    const Size firstCold = static_cast<Size>(translation.cold.size());
+
+    if (!IsTranslated(instruction))
+    {
+        Fallback(translation, index);
+        return;
+    }
+
+    if (opcode >= 0x40 && opcode < 0x80)
+    {
+        // ld r8, r8 with [hl] on either side
+        const U8 destination = (opcode >> 3) & 0x07;
+        const U8 source = opcode & 0x07;
+
+        if (source == 6)
+        {
+            Encode({ 0x8B }, RCX, GUEST_HL, DWORD); // mov ecx, hl
+            ReadMemory(translation, index);
+            StoreRegister8(destination, RAX);
+        }
+        else if (destination == 6)
+        {
+            Encode({ 0x8B }, RCX, GUEST_HL, DWORD); // mov ecx, hl
+            LoadRegister8(R8, source);
+            WriteMemory(translation, index);
+        }
+        else if (destination != source)
+        {
+            LoadRegister8(RAX, source);
+            StoreRegister8(destination, RAX);
+        }
+    }
+    else if (opcode >= 0x80 && opcode < 0xC0)
+    {
+        const U8 source = opcode & 0x07;
+        if (source == 6)
+        {
+            Encode({ 0x8B }, RCX, GUEST_HL, DWORD); // mov ecx, hl
+            ReadMemory(translation, index);
+            Encode({ 0x8B }, RCX, RAX, DWORD); // mov ecx, eax
+        }
+        else
+        {
+            LoadRegister8(RCX, source);
+        }
+
+        TranslateAlu(translation, index, (opcode >> 3) & 0x07, RCX);
+    }
+    else if ((opcode & 0xC7) == 0xC6)
+    {
+        // alu a, imm8
+        MoveImmediate(RCX, instruction.operands[0]);
+        TranslateAlu(translation, index, (opcode >> 3) & 0x07, RCX);
+    }
+    else if (opcode < 0x40 && (opcode & 0x07) == 0x04)
+    {
+        // inc r8
+        const U8 reg = (opcode >> 3) & 0x07;
+        LoadRegister8(RCX, reg);
+        Encode({ 0x8D }, RAX, Memory{ RCX, 1 }, DWORD); // lea eax, [rcx + 1]
+        Encode({ 0x0F, 0xB6 }, RAX, RAX, BYTE_RM); // movzx eax, al
+        StoreFlag(translation, index, ZERO, RAX);
+        StoreFlag(translation, index, SUBTRACT, 0);
+        if (translation.live[index] & HALF)
+        {
+            Encode({ 0x8B }, RDX, RCX, DWORD); // mov edx, ecx
+            Encode({ 0x33 }, RDX, RAX, DWORD); // xor edx, eax
+            StoreFlag(translation, index, HALF, RDX);
+        }
+        StoreRegister8(reg, RAX);
+    }
+    else if (opcode < 0x40 && (opcode & 0x07) == 0x05)
+    {
+        // dec r8
+        const U8 reg = (opcode >> 3) & 0x07;
+        LoadRegister8(RCX, reg);
+        Encode({ 0x8D }, RAX, Memory{ RCX, -1 }, DWORD); // lea eax, [rcx - 1]
+        Encode({ 0x0F, 0xB6 }, RAX, RAX, BYTE_RM); // movzx eax, al
+        StoreFlag(translation, index, ZERO, RAX);
+        StoreFlag(translation, index, SUBTRACT, 1);
+        if (translation.live[index] & HALF)
+        {
+            Encode({ 0x8B }, RDX, RCX, DWORD); // mov edx, ecx
+            Encode({ 0x33 }, RDX, RAX, DWORD); // xor edx, eax
+            StoreFlag(translation, index, HALF, RDX);
+        }
+        StoreRegister8(reg, RAX);
+    }
+    else if (opcode < 0x40 && (opcode & 0x07) == 0x06)
+    {
+        // ld r8, imm8
+        const U8 reg = (opcode >> 3) & 0x07;
+        if (reg == 6)
+        {
+            Encode({ 0x8B }, RCX, GUEST_HL, DWORD); // mov ecx, hl
+            MoveImmediate(R8, instruction.operands[0]);
+            WriteMemory(translation, index);
+        }
+        else
+        {
+            MoveImmediate(RAX, instruction.operands[0]);
+            StoreRegister8(reg, RAX);
+        }
+    }
+    else
+    {
+        switch (opcode)
+        {
+        case 0x00: // nop
+            break;
+
+        case 0x01: case 0x11: case 0x21: case 0x31: // ld r16, imm16
+            MoveImmediate(Register16(opcode >> 4), imm16);
+            break;
+
+        case 0x02: case 0x12: case 0x22: case 0x32: // ld [r16mem], a
+            Encode({ 0x8B }, RCX, opcode < 0x20 ? Register16(opcode >> 4) : GUEST_HL, DWORD); // mov ecx, r16
+            Encode({ 0x8B }, R8, GUEST_A, DWORD); // mov r8d, ebx
+            WriteMemory(translation, index);
+            if (opcode == 0x22) Encode({ 0xFF }, 0, GUEST_HL, WORD); // inc r13w
+            if (opcode == 0x32) Encode({ 0xFF }, 1, GUEST_HL, WORD); // dec r13w
+            break;
+
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A: // ld a, [r16mem]
+            Encode({ 0x8B }, RCX, opcode < 0x20 ? Register16(opcode >> 4) : GUEST_HL, DWORD); // mov ecx, r16
+            ReadMemory(translation, index);
+            Encode({ 0x8B }, GUEST_A, RAX, DWORD); // mov ebx, eax
+            if (opcode == 0x2A) Encode({ 0xFF }, 0, GUEST_HL, WORD); // inc r13w
+            if (opcode == 0x3A) Encode({ 0xFF }, 1, GUEST_HL, WORD); // dec r13w
+            break;
+
+        case 0x03: case 0x13: case 0x23: case 0x33: // inc r16, wrapping in 16 bits
+            Encode({ 0xFF }, 0, Register16(opcode >> 4), WORD);
+            break;
+
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B: // dec r16
+            Encode({ 0xFF }, 1, Register16(opcode >> 4), WORD);
+            break;
+
+        case 0x09: case 0x19: case 0x29: case 0x39: // add hl, r16
+        {
+            const Register value = Register16(opcode >> 4);
+            Encode({ 0x8B }, RAX, GUEST_HL, DWORD); // mov eax, hl
+            Encode({ 0x03 }, RAX, value, DWORD); // add eax, r16
+            StoreFlag(translation, index, SUBTRACT, 0);
+            if (translation.live[index] & HALF)
+            {
+                // Carries out of bits 11 and 15, shifted down onto the 8-bit positions
+                Encode({ 0x8B }, RDX, GUEST_HL, DWORD); // mov edx, hl
+                Encode({ 0x33 }, RDX, value, DWORD); // xor edx, r16
+                Encode({ 0x33 }, RDX, RAX, DWORD); // xor edx, eax
+                Encode({ 0xC1 }, 5, RDX, DWORD); // shr edx, 8
+                Emit({ 8 });
+                StoreFlag(translation, index, HALF, RDX);
+            }
+            if (translation.live[index] & CARRY)
+            {
+                Encode({ 0x8B }, RDX, RAX, DWORD); // mov edx, eax
+                Encode({ 0xC1 }, 5, RDX, DWORD); // shr edx, 8
+                Emit({ 8 });
+                StoreFlag(translation, index, CARRY, RDX);
+            }
+            Encode({ 0x0F, 0xB7 }, GUEST_HL, RAX, DWORD); // movzx r13d, ax
+            break;
+        }
+
+        case 0x2F: // cpl
+            Encode({ 0x81 }, 6, GUEST_A, DWORD); // xor ebx, 0xFF
+            Emit32(0xFF);
+            StoreFlag(translation, index, SUBTRACT, 1);
+            StoreFlag(translation, index, HALF, 0x10);
+            break;
+
+        case 0x37: // scf
+            StoreFlag(translation, index, SUBTRACT, 0);
+            StoreFlag(translation, index, HALF, 0);
+            StoreFlag(translation, index, CARRY, 0x100);
+            break;
+
+        case 0x3F: // ccf
+            StoreFlag(translation, index, SUBTRACT, 0);
+            StoreFlag(translation, index, HALF, 0);
+            if (translation.live[index] & CARRY)
+            {
+                Encode({ 0x81 }, 6, Memory{ STATE, environment.carry }, WORD); // xor word [carry], 0x100
+                Emit16(0x100);
+            }
+            break;
+
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr (cond), imm8
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // jp (cond), imm16
+            TranslateBranch(translation, index);
+            break;
+
+        case 0xE0: // ldh [imm8], a, HRAM only
+        case 0xEA: // ld [imm16], a
+        {
+            const Address address = opcode == 0xE0 ? static_cast<Address>(0xFF00 + instruction.operands[0]) : imm16;
+            MoveImmediate(RCX, address);
+            Encode({ 0x8B }, R8, GUEST_A, DWORD); // mov r8d, ebx
+
+            if (IsHighRAM(address))
+            {
+                MoveImmediate64(RAX, reinterpret_cast<U64>(environment.highRAM + (address - 0xFF80)));
+                Encode({ 0x88 }, R8, Memory{ RAX }, BYTE_REG); // mov [rax], r8b
+                CheckCodeWrite(translation, index);
+            }
+            else
+            {
+                WriteMemory(translation, index);
+            }
+            break;
+        }
+
+        case 0xF0: // ldh a, [imm8], HRAM only
+        case 0xFA: // ld a, [imm16]
+        {
+            const Address address = opcode == 0xF0 ? static_cast<Address>(0xFF00 + instruction.operands[0]) : imm16;
+
+            if (IsHighRAM(address))
+            {
+                MoveImmediate64(RAX, reinterpret_cast<U64>(environment.highRAM + (address - 0xFF80)));
+                Encode({ 0x0F, 0xB6 }, GUEST_A, Memory{ RAX }, DWORD); // movzx ebx, byte [rax]
+            }
+            else
+            {
+                MoveImmediate(RCX, address);
+                ReadMemory(translation, index);
+                Encode({ 0x8B }, GUEST_A, RAX, DWORD); // mov ebx, eax
+            }
+            break;
+        }
+
+        case 0xF9: // ld sp, hl
+            Encode({ 0x8B }, GUEST_SP, GUEST_HL, DWORD);
+            break;
+        }
+    }
+
+    // Slow paths run the whole instruction and continue after it
+    for (Size i = firstCold; i < translation.cold.size(); i++) translation.cold[i].resume = static_cast<Size>(m_Buffer.size());
+}
+
+void Recompiler::TranslateAlu(Translation& translation, Size index, U8 operation, Register value)
+{
+    const Environment& environment = *translation.environment;
+    const U8 live = translation.live[index];
+    const bool arithmetic = operation <= 3 || operation == 7;
+
+    // EAX = A op value, unwrapped: bit 8 is the carry or borrow, as in the interpreter
+    if (operation == 1 || operation == 3)
+    {
+        Encode({ 0x0F, 0xB6 }, RDX, Memory{ STATE, environment.carry + 1 }, DWORD); // movzx edx, byte [carry + 1]
+        Encode({ 0x83 }, 4, RDX, DWORD); // and edx, 1
+        Emit({ 0x01 });
+    }
+
+    Encode({ 0x8B }, RAX, GUEST_A, DWORD); // mov eax, ebx
+    switch (operation)
+    {
+    case 0: Encode({ 0x03 }, RAX, value, DWORD); break; // add
+    case 1: Encode({ 0x03 }, RAX, value, DWORD); Encode({ 0x03 }, RAX, RDX, DWORD); break; // adc
+    case 2: case 7: Encode({ 0x2B }, RAX, value, DWORD); break; // sub, cp
+    case 3: Encode({ 0x2B }, RAX, value, DWORD); Encode({ 0x2B }, RAX, RDX, DWORD); break; // sbc
+    case 4: Encode({ 0x23 }, RAX, value, DWORD); break; // and
+    case 5: Encode({ 0x33 }, RAX, value, DWORD); break; // xor
+    case 6: Encode({ 0x0B }, RAX, value, DWORD); break; // or
+    }
+
+    StoreFlag(translation, index, ZERO, RAX);
+    StoreFlag(translation, index, SUBTRACT, operation == 2 || operation == 3 || operation == 7);
+
+    if (arithmetic)
+    {
+        if (live & HALF)
+        {
+            Encode({ 0x8B }, RDX, GUEST_A, DWORD); // mov edx, ebx
+            Encode({ 0x33 }, RDX, value, DWORD); // xor edx, value
+            Encode({ 0x33 }, RDX, RAX, DWORD); // xor edx, eax
+            StoreFlag(translation, index, HALF, RDX);
+        }
+        StoreFlag(translation, index, CARRY, RAX);
+    }
+    else
+    {
+        StoreFlag(translation, index, HALF, operation == 4 ? 0x10 : 0x00);
+        StoreFlag(translation, index, CARRY, 0);
+    }
+
+    if (operation != 7) Encode({ 0x0F, 0xB6 }, GUEST_A, RAX, BYTE_RM); // movzx ebx, al
+}
+
+void Recompiler::TranslateBranch(Translation& translation, Size index)
+{
+    const auto& block = *translation.block;
+    const auto& instruction = block.instructions[index];
+    const Environment& environment = *translation.environment;
+    const U8 opcode = instruction.opcode;
+
+    const bool relative = opcode < 0x40;
+    const Address next = static_cast<Address>(instruction.address + (relative ? 2 : 3));
+    const Address target = relative ?
+        static_cast<Address>(next + static_cast<S8>(instruction.operands[0])) :
+        static_cast<Address>(instruction.operands[0] | (instruction.operands[1] << 8));
+
+    const bool conditional = opcode != 0x18 && opcode != 0xC3;
+    const U32 notTaken = translation.offsets[index] + environment.cycles[opcode];
+    const U32 taken = notTaken + (conditional ? environment.jumpTakenCycles : 0);
+
+    if (conditional)
+    {
+        // Condition field: NZ, Z, NC, C
+        const U8 condition = (opcode >> 3) & 0x03;
+        Condition jump;
+
+        if (condition < 2)
+        {
+            Encode({ 0x80 }, 7, Memory{ STATE, environment.zero }, DWORD); // cmp byte [zero], 0
+            Emit({ 0x00 });
+            jump = condition == 0 ? NOT_EQUAL : EQUAL;
+        }
+        else
+        {
+            Encode({ 0xF6 }, 0, Memory{ STATE, environment.carry + 1 }, DWORD); // test byte [carry + 1], 1
+            Emit({ 0x01 });
+            jump = condition == 2 ? EQUAL : NOT_EQUAL;
+        }
+
+        Label branch;
+        Jump(branch, jump);
+        Exit(environment, next, notTaken);
+        Place(branch);
+    }
+
+    // A block that jumps back to its own start loops in native code, the budget check of its first
+    // instruction ends it. Idle loops are left every pass, so that they can be skipped instead.
+    if (target == block.start && !block.idleLoop)
+    {
+        Encode({ 0x81 }, 0, Memory{ STATE, environment.passCycles }, DWORD); // add dword [passCycles], taken
+        Emit32(taken);
+        Encode({ 0x81 }, 5, Memory{ RSP, BUDGET_SLOT }, DWORD); // sub dword [budget], taken
+        Emit32(taken);
+        JumpTo(translation.loop);
+    }
+    else
+    {
+        Exit(environment, target, taken);
+    }
+}
+
+void Recompiler::CheckBudget(Translation& translation, Size index)
+{
+    // Events fire between instructions: stop before the first one that would run past the next
+    Encode({ 0x81 }, 7, Memory{ RSP, BUDGET_SLOT }, DWORD); // cmp dword [budget], end
+    Emit32(translation.ends[index]);
+
+    translation.cold.push_back({ ColdPath::Kind::Budget, index });
+    Jump(translation.cold.back().entry, BELOW);
+}
+
+#pragma endregion
+
+#pragma region Operands
+
+void Recompiler::LoadRegister8(Register destination, U8 reg)
+{
+    if (reg == 7)
+    {
+        Encode({ 0x8B }, destination, GUEST_A, DWORD); // mov dst, ebx
+        return;
+    }
+
+    const Register pair = Register16(reg >> 1);
+    if (reg & 1)
+    {
+        Encode({ 0x0F, 0xB6 }, destination, pair, BYTE_RM); // movzx dst, pair low
+    }
+    else
+    {
+        Encode({ 0x8B }, destination, pair, DWORD); // mov dst, pair
+        Encode({ 0xC1 }, 5, destination, DWORD); // shr dst, 8
+        Emit({ 8 });
+    }
+}
+
+void Recompiler::StoreRegister8(U8 reg, Register source)
+{
+    if (reg == 7)
+    {
+        Encode({ 0x0F, 0xB6 }, GUEST_A, source, BYTE_RM); // movzx ebx, src low
+        return;
+    }
+
+    const Register pair = Register16(reg >> 1);
+    if (reg & 1)
+    {
+        Encode({ 0x88 }, source, pair, BYTE); // mov pair low, src low
+    }
+    else
+    {
+        Encode({ 0x0F, 0xB6 }, R11, source, BYTE_RM); // movzx r11d, src low
+        Encode({ 0xC1 }, 4, R11, DWORD); // shl r11d, 8
+        Emit({ 8 });
+        Encode({ 0x0F, 0xB6 }, pair, pair, BYTE_RM); // movzx pair, pair low
+        Encode({ 0x09 }, R11, pair, DWORD); // or pair, r11d
+    }
+}
+
+Recompiler::Register Recompiler::Register16(U8 reg)
+{
+    // BC, DE, HL, SP
+    static constexpr Register k_Pairs[] = { GUEST_BC, GUEST_DE, GUEST_HL, GUEST_SP };
+    return k_Pairs[reg & 0x03];
+}
+
+void Recompiler::ReadMemory(Translation& translation, Size index)
+{
+    const Environment& environment = *translation.environment;
+
+    Encode({ 0x8B }, RAX, RCX, DWORD); // mov eax, ecx
+    Encode({ 0xC1 }, 5, RAX, DWORD); // shr eax, 8
+    Emit({ 8 });
+    MoveImmediate64(RDX, reinterpret_cast<U64>(environment.readPages));
+    Encode({ 0x8B }, RDX, Memory{ RDX, 0, RAX, 3 }, QWORD); // mov rdx, [rdx + rax * 8]
+    Encode({ 0x85 }, RDX, RDX, QWORD); // test rdx, rdx
+
+    translation.cold.push_back({ ColdPath::Kind::Read, index });
+    Jump(translation.cold.back().entry, EQUAL);
+
+    Encode({ 0x0F, 0xB6 }, RAX, RCX, BYTE_RM); // movzx eax, cl
+    Encode({ 0x0F, 0xB6 }, RAX, Memory{ RDX, 0, RAX, 0 }, DWORD); // movzx eax, byte [rdx + rax]
+}
+
+void Recompiler::WriteMemory(Translation& translation, Size index)
+{
+    const Environment& environment = *translation.environment;
+
+    Encode({ 0x8B }, RAX, RCX, DWORD); // mov eax, ecx
+    Encode({ 0xC1 }, 5, RAX, DWORD); // shr eax, 8
+    Emit({ 8 });
+    MoveImmediate64(RDX, reinterpret_cast<U64>(environment.writePages));
+    Encode({ 0x8B }, RDX, Memory{ RDX, 0, RAX, 3 }, QWORD); // mov rdx, [rdx + rax * 8]
+    Encode({ 0x85 }, RDX, RDX, QWORD); // test rdx, rdx
+
+    translation.cold.push_back({ ColdPath::Kind::Write, index });
+    Jump(translation.cold.back().entry, EQUAL);
+
+    Encode({ 0x0F, 0xB6 }, RAX, RCX, BYTE_RM); // movzx eax, cl
+    Encode({ 0x88 }, R8, Memory{ RDX, 0, RAX, 0 }, BYTE_REG); // mov [rdx + rax], r8b
+    CheckCodeWrite(translation, index);
+}
+
+void Recompiler::CheckCodeWrite(Translation& translation, Size index)
+{
+    // Same as the bus: only a write onto a cached instruction byte does any work
+    MoveImmediate64(RDX, reinterpret_cast<U64>(translation.environment->codeBytes));
+    Encode({ 0x80 }, 7, Memory{ RDX, 0, RCX, 0 }, DWORD); // cmp byte [rdx + rcx], 0
+    Emit({ 0x00 });
+
+    translation.cold.push_back({ ColdPath::Kind::Invalidate, index });
+    Jump(translation.cold.back().entry, NOT_EQUAL);
+}
+
+void Recompiler::StoreFlag(const Translation& translation, Size index, FlagField field, Register source)
+{
+    if (!(translation.live[index] & field)) return;
+
+    const Environment& environment = *translation.environment;
+    switch (field)
+    {
+    case ZERO: Encode({ 0x88 }, source, Memory{ STATE, environment.zero }, BYTE_REG); break;
+    case HALF: Encode({ 0x88 }, source, Memory{ STATE, environment.half }, BYTE_REG); break;
+    case CARRY: Encode({ 0x89 }, source, Memory{ STATE, environment.carry }, WORD); break;
+    default: break;
+    }
+}
+
+void Recompiler::StoreFlag(const Translation& translation, Size index, FlagField field, U16 value)
+{
+    if (!(translation.live[index] & field)) return;
+
+    const Environment& environment = *translation.environment;
+    switch (field)
+    {
+    case ZERO: Encode({ 0xC6 }, 0, Memory{ STATE, environment.zero }, DWORD); Emit({ static_cast<U8>(value) }); break;
+    case SUBTRACT: Encode({ 0xC6 }, 0, Memory{ STATE, environment.subtract }, DWORD); Emit({ static_cast<U8>(value) }); break;
+    case HALF: Encode({ 0xC6 }, 0, Memory{ STATE, environment.half }, DWORD); Emit({ static_cast<U8>(value) }); break;
+    case CARRY: Encode({ 0xC7 }, 0, Memory{ STATE, environment.carry }, WORD); Emit16(value); break;
+    default: break;
+    }
+}
+
+#pragma endregion
+
+#pragma region Interpreter Calls and Exits
+
+void Recompiler::Fallback(Translation& translation, Size index)
+{
+    const Environment& environment = *translation.environment;
+    const U32 offset = translation.offsets[index];
+
+    SpillRegisters(environment);
+    CallStep(translation, index);
+    ReloadRegisters(environment);
+
+    if (index + 1 == translation.block->instructions.size())
+    {
+        // The interpreter set PC, and the cycles include a taken branch
+        ExitAfterStep(environment, offset);
+        return;
+    }
+
+    Label stay;
+    Emit({ 0x84, 0xC0 }); // test al, al
+    Jump(stay, NOT_EQUAL);
+    ExitAfterStep(environment, offset);
+    Place(stay);
+}
+
+void Recompiler::CallStep(const Translation& translation, Size index)
+{
+    const auto& instruction = translation.block->instructions[index];
+    const Environment& environment = *translation.environment;
+
+    Encode({ 0x8B }, ARGUMENTS[0], STATE, QWORD); // mov arg0, r15
+    MoveImmediate64(ARGUMENTS[1], reinterpret_cast<U64>(&instruction));
+    MoveImmediate(ARGUMENTS[2], translation.offsets[index]);
+    Call(reinterpret_cast<const void*>((*environment.steps)[instruction.opcode]));
+}
+
+void Recompiler::SpillRegisters(const Environment& environment)
+{
+    Encode({ 0x88 }, GUEST_A, Memory{ STATE, environment.a }, BYTE_REG);
+    Encode({ 0x89 }, GUEST_BC, Memory{ STATE, environment.bc }, WORD);
+    Encode({ 0x89 }, GUEST_DE, Memory{ STATE, environment.de }, WORD);
+    Encode({ 0x89 }, GUEST_HL, Memory{ STATE, environment.hl }, WORD);
+    Encode({ 0x89 }, GUEST_SP, Memory{ STATE, environment.sp }, WORD);
+}
+
+void Recompiler::ReloadRegisters(const Environment& environment)
+{
+    Encode({ 0x0F, 0xB6 }, GUEST_A, Memory{ STATE, environment.a }, DWORD);
+    Encode({ 0x0F, 0xB7 }, GUEST_BC, Memory{ STATE, environment.bc }, DWORD);
+    Encode({ 0x0F, 0xB7 }, GUEST_DE, Memory{ STATE, environment.de }, DWORD);
+    Encode({ 0x0F, 0xB7 }, GUEST_HL, Memory{ STATE, environment.hl }, DWORD);
+    Encode({ 0x0F, 0xB7 }, GUEST_SP, Memory{ STATE, environment.sp }, DWORD);
+}
+
+void Recompiler::Exit(const Environment& environment, Address pc, U32 cycles)
+{
+    Encode({ 0xC7 }, 0, Memory{ STATE, environment.pc }, WORD); // mov word [pc], imm16
+    Emit16(pc);
+    Encode({ 0x8B }, RAX, Memory{ STATE, environment.passCycles }, DWORD); // mov eax, [passCycles]
+    Emit({ 0x05 }); // add eax, imm32
+    Emit32(cycles);
+    Jump(m_Leave);
+}
+
+void Recompiler::ExitAfterStep(const Environment& environment, U32 offset)
+{
+    Encode({ 0x8B }, RAX, Memory{ STATE, environment.passCycles }, DWORD); // mov eax, [passCycles]
+    Encode({ 0x03 }, RAX, Memory{ STATE, environment.stepCycles }, DWORD); // add eax, [stepCycles]
+    Emit({ 0x05 }); // add eax, imm32
+    Emit32(offset);
+    Jump(m_Leave);
+}
+
+#pragma endregion
+
+#pragma region Encoding
+
+void Recompiler::Encode(std::initializer_list<U8> opcode, U8 reg, Register rm, U8 encoding)
+{
+    if (encoding & WORD) Emit({ 0x66 });
+
+    U8 rex = (encoding & QWORD) ? 0x48 : 0x00;
+    if (reg & 0x08) rex |= 0x44;
+    if (rm & 0x08) rex |= 0x41;
+    if ((encoding & BYTE_REG) && reg >= RSP && reg <= RDI) rex |= 0x40;
+    if ((encoding & BYTE_RM) && rm >= RSP && rm <= RDI) rex |= 0x40;
+    if (rex != 0) Emit({ rex });
+
+    m_Buffer.insert(m_Buffer.end(), opcode);
+    Emit({ static_cast<U8>(0xC0 | (reg & 0x07) << 3 | (rm & 0x07)) });
+}
+
+void Recompiler::Encode(std::initializer_list<U8> opcode, U8 reg, const Memory& memory, U8 encoding)
+{
+    if (encoding & WORD) Emit({ 0x66 });
+
+    U8 rex = (encoding & QWORD) ? 0x48 : 0x00;
+    if (reg & 0x08) rex |= 0x44;
+    if (memory.index & 0x08) rex |= 0x42;
+    if (memory.base & 0x08) rex |= 0x41;
+    if ((encoding & BYTE_REG) && reg >= RSP && reg <= RDI) rex |= 0x40;
+    if (rex != 0) Emit({ rex });
+
+    m_Buffer.insert(m_Buffer.end(), opcode);
+
+    // [base + index * scale + displacement]; RBP/R13 as base always need a displacement, RSP/R12 a SIB byte
+    const bool sib = memory.index != RSP || (memory.base & 0x07) == RSP;
+    const bool byteDisplacement = memory.displacement >= -128 && memory.displacement <= 127;
+    const U8 mode = memory.displacement == 0 && (memory.base & 0x07) != RBP ? 0x00 : byteDisplacement ? 0x40 : 0x80;
+
+    Emit({ static_cast<U8>(mode | (reg & 0x07) << 3 | (sib ? 0x04 : memory.base & 0x07)) });
+    if (sib) Emit({ static_cast<U8>(memory.scale << 6 | (memory.index & 0x07) << 3 | (memory.base & 0x07)) });
+
+    if (mode == 0x40) Emit({ static_cast<U8>(memory.displacement) });
+    else if (mode == 0x80) Emit32(static_cast<U32>(memory.displacement));
+}
+
+void Recompiler::MoveImmediate(Register destination, U32 value)
+{
+    if (destination & 0x08) Emit({ 0x41 });
+    Emit({ static_cast<U8>(0xB8 + (destination & 0x07)) }); // mov r32, imm32
+    Emit32(value);
+}
+
+void Recompiler::MoveImmediate64(Register destination, U64 value)
+{
+    Emit({ static_cast<U8>(destination & 0x08 ? 0x49 : 0x48), static_cast<U8>(0xB8 + (destination & 0x07)) }); // mov r64, imm64
+    Emit64(value);
+}
+
+void Recompiler::Call(const void* function)
+{
+    MoveImmediate64(RAX, reinterpret_cast<U64>(function));
+    Emit({ 0xFF, 0xD0 }); // call rax
+}
+
+void Recompiler::Jump(Label& label, Condition condition)
+{
+    if (condition == ALWAYS) Emit({ 0xE9 }); // jmp rel32
+    else Emit({ 0x0F, static_cast<U8>(0x80 | condition) }); // jcc rel32
+
+    label.push_back(static_cast<Size>(m_Buffer.size()));
+    Emit32(0);
+}
+
+void Recompiler::JumpTo(Size target, Condition condition)
+{
+    if (condition == ALWAYS) Emit({ 0xE9 });
+    else Emit({ 0x0F, static_cast<U8>(0x80 | condition) });
+
+    Emit32(static_cast<U32>(static_cast<S32>(target) - static_cast<S32>(m_Buffer.size() + 4)));
+}
+
+void Recompiler::Place(Label& label)
+{
+    const Size target = static_cast<Size>(m_Buffer.size());
+    for (const Size jump : label)
+    {
+        const U32 displacement = target - (jump + 4);
+        std::memcpy(&m_Buffer[jump], &displacement, sizeof(displacement));
+    }
+    label.clear();
+}
+
+void Recompiler::Emit(std::initializer_list<U8> bytes)
+{
+    m_Buffer.insert(m_Buffer.end(), bytes);
+}
+
+void Recompiler::Emit16(U16 value)
+{
+    for (int i = 0; i < 2; i++) m_Buffer.push_back(static_cast<U8>(value >> (i * 8)));
+}
+
+void Recompiler::Emit32(U32 value)
+{
+    for (int i = 0; i < 4; i++) m_Buffer.push_back(static_cast<U8>(value >> (i * 8)));
+}
+
+void Recompiler::Emit64(U64 value)
+{
+    for (int i = 0; i < 8; i++) m_Buffer.push_back(static_cast<U8>(value >> (i * 8)));
+}
+
+#pragma endregion
+
+#endif
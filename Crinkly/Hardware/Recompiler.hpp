@@ -0,0 +1,293 @@
+#pragma once
+#include <array>
+#include <initializer_list>
+#include <vector>
+
+#include "BlockCache.hpp"
+#include "Utility/Types.hpp"
+
+class CPU;
+
+// x86-64 block translator for ROM and RAM code. Loads, 8-bit ALU ops, inc/dec, add hl and jumps are translated to inline
+// code working on guest registers pinned in host registers; memory goes through the bus page tables
+// inline, with the slow path (I/O, unmapped pages) falling back to the interpreter. Everything else
+// calls the interpreter handler of its opcode. Flags are only stored when a later reader needs them.
+class Recompiler
+{
+public:
+    // Runs one decoded instruction on the interpreter, `offset` T-cycles into the current pass.
+    // Returns false when native code has to be left: PC went elsewhere, the code under the block
+    // changed, an interrupt is about to be taken or the next event moved.
+    using Step = bool (*)(CPU* cpu, const BlockCache::DecodedInstruction* instruction, U32 offset);
+
+    // Drops the cached blocks covering a written address
+    using Invalidate = void (*)(CPU* cpu, U32 address);
+
+    // Everything a translation touches, supplied by the CPU. Guest state is addressed as byte
+    // offsets from the CPU object a translation is called with.
+    struct Environment
+    {
+        S32 a, bc, de, hl, sp, pc;
+        S32 zero, half, carry, subtract;
+
+        // T-cycles of the passes completed so far, and of the instruction a step just ran
+        S32 passCycles, stepCycles;
+
+        const U8* cycles;
+        const U8* cyclesPrefixed;
+        U8 jumpTakenCycles;
+        U8 maxTakenCycles;
+
+        const Byte* const* readPages;
+        Byte* const* writePages;
+        Byte* highRAM;
+        const U8* codeBytes;
+
+        const std::array<Step, 256>* steps;
+        Invalidate invalidate;
+    };
+
+    static constexpr U32 HOT_BLOCK_ENTRIES = 32;
+    static constexpr Size CODE_BUFFER_SIZE = 8 * 1024 * 1024;
+
+public:
+    Recompiler();
+    ~Recompiler();
+
+    Recompiler(const Recompiler&) = delete;
+    Recompiler& operator=(const Recompiler&) = delete;
+
+    // Sets block.native and block.entryCycles. Returns false once the code buffer is full; the
+    // caller then clears the block cache.
+    bool Compile(BlockCache::Block& block, const Environment& environment);
+
+    // Forgets every translation and reuses the code buffer from the start. Only valid while no
+    // block refers to native code anymore, i.e. right after the block cache was cleared.
+    void Reset() { m_Used = 0; }
+
+private:
+    // Host registers. The guest registers live in callee-saved ones, so only the interpreter
+    // fallbacks have to spill and reload them.
+    enum Register : U8
+    {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    static constexpr Register GUEST_A = RBX;
+    static constexpr Register GUEST_BC = RBP;
+    static constexpr Register GUEST_DE = R12;
+    static constexpr Register GUEST_HL = R13;
+    static constexpr Register GUEST_SP = R14;
+    static constexpr Register STATE = R15;
+
+#ifdef _WIN32
+    static constexpr Register ARGUMENTS[] = { RCX, RDX, R8 };
+    static constexpr S32 FRAME_SIZE = 40; // shadow space, the budget and alignment
+    static constexpr S32 BUDGET_SLOT = 32; // T-cycles left from the start of the current pass
+#else
+    static constexpr Register ARGUMENTS[] = { RDI, RSI, RDX };
+    static constexpr S32 FRAME_SIZE = 8;
+    static constexpr S32 BUDGET_SLOT = 0; // T-cycles left from the start of the current pass
+#endif
+
+    // Operand size and which operands are byte registers (those need a REX prefix for spl..dil)
+    enum Encoding : U8
+    {
+        DWORD = 0x00,
+        QWORD = 0x01,
+        WORD = 0x02,
+        BYTE_REG = 0x04,
+        BYTE_RM = 0x08,
+        BYTE = BYTE_REG | BYTE_RM
+    };
+
+    struct Memory
+    {
+        Register base;
+        S32 displacement = 0;
+        Register index = RSP; // RSP can't be an index, so it stands for none
+        U8 scale = 0;
+    };
+
+    // Flag fields, for the liveness analysis
+    enum FlagField : U8
+    {
+        ZERO = 0x01,
+        SUBTRACT = 0x02,
+        HALF = 0x04,
+        CARRY = 0x08,
+        ALL_FLAGS = 0x0F
+    };
+
+    // x86 condition codes, for jcc
+    enum Condition : U8
+    {
+        BELOW = 0x2,
+        EQUAL = 0x4,
+        NOT_EQUAL = 0x5,
+        ALWAYS = 0xFF
+    };
+
+    // A forward jump whose 32-bit displacement is patched once the target is placed
+    using Label = std::vector<Size>;
+
+    // Code placed after the block body, for paths that are rarely taken
+    struct ColdPath
+    {
+        // Unmapped read or write: the interpreter runs the instruction. A write to cached code
+        // finishes the instruction and leaves, the rest of the block may just have changed. An
+        // instruction that does not fit in the budget leaves before it starts.
+        enum class Kind : U8 { Read, Write, Invalidate, Budget } kind;
+        Size instruction;
+        Label entry;
+        Size resume = 0;
+    };
+
+    struct Translation
+    {
+        const BlockCache::Block* block;
+        const Environment* environment;
+        std::vector<U32> offsets; // T-cycles into the pass at which each instruction starts
+        std::vector<U32> ends;    // and by which it has finished at the latest
+        U32 cycles;               // of a pass that does not take its final jump
+        std::vector<U8> live;     // flag fields read before being overwritten, after each instruction
+        std::vector<ColdPath> cold;
+        Size loop;                // code offset of the first instruction
+    };
+
+private:
+    void Protect(U8* code, Size size, bool executable);
+
+    // Flags each instruction reads and writes; fallbacks may read anything and may leave the block
+    static constexpr U8 FlagsUsed(const BlockCache::DecodedInstruction& instruction);
+    static constexpr U8 FlagsDefined(const BlockCache::DecodedInstruction& instruction);
+    static constexpr bool IsTranslated(const BlockCache::DecodedInstruction& instruction);
+    static constexpr bool IsHighRAM(Address address) { return address >= 0xFF80 && address < 0xFFFF; }
+
+    void Translate(Translation& translation, Size index);
+    void TranslateAlu(Translation& translation, Size index, U8 operation, Register value);
+    void TranslateBranch(Translation& translation, Size index);
+    void CheckBudget(Translation& translation, Size index);
+
+    // Guest operands, decoded the way the interpreter tables do it (B, C, D, E, H, L, [HL], A)
+    void LoadRegister8(Register destination, U8 reg);
+    void StoreRegister8(U8 reg, Register source);
+    static Register Register16(U8 reg);
+
+    // Memory access through the page tables, address in ECX; the value is EAX for reads and R8 for
+    // writes. Unmapped pages run the whole instruction on the interpreter instead.
+    void ReadMemory(Translation& translation, Size index);
+    void WriteMemory(Translation& translation, Size index);
+    void CheckCodeWrite(Translation& translation, Size index);
+
+    void StoreFlag(const Translation& translation, Size index, FlagField field, Register source);
+    void StoreFlag(const Translation& translation, Size index, FlagField field, U16 value);
+
+    void Fallback(Translation& translation, Size index);
+    void CallStep(const Translation& translation, Size index);
+    void SpillRegisters(const Environment& environment);
+    void ReloadRegisters(const Environment& environment);
+    void Exit(const Environment& environment, Address pc, U32 cycles);
+    void ExitAfterStep(const Environment& environment, U32 offset);
+
+    // Instruction encoding
+    void Encode(std::initializer_list<U8> opcode, U8 reg, Register rm, U8 encoding);
+    void Encode(std::initializer_list<U8> opcode, U8 reg, const Memory& memory, U8 encoding);
+    void MoveImmediate(Register destination, U32 value);
+    void MoveImmediate64(Register destination, U64 value);
+    void Call(const void* function);
+    void Jump(Label& label, Condition condition = ALWAYS);
+    void JumpTo(Size target, Condition condition = ALWAYS);
+    void Place(Label& label);
+
+    void Emit(std::initializer_list<U8> bytes);
+    void Emit16(U16 value);
+    void Emit32(U32 value);
+    void Emit64(U64 value);
+
+private:
+    U8* m_Code;
+    Size m_Used;
+    std::vector<U8> m_Buffer;
+    Label m_Leave;
+};
+
+constexpr bool Recompiler::IsTranslated(const BlockCache::DecodedInstruction& instruction)
+{
+    const U8 opcode = instruction.opcode;
+    const Address address = static_cast<Address>(instruction.operands[0] | (instruction.operands[1] << 8));
+
+    // ld r8, r8 except the ld b, b test breakpoint and halt, and the ALU ops
+    if (opcode >= 0x40 && opcode < 0x80) return opcode != 0x40 && opcode != 0x76;
+    if (opcode >= 0x80 && opcode < 0xC0) return true;
+
+    switch (opcode)
+    {
+    case 0x00: // nop
+    case 0x01: case 0x11: case 0x21: case 0x31: // ld r16, imm16
+    case 0x02: case 0x12: case 0x22: case 0x32: // ld [r16mem], a
+    case 0x0A: case 0x1A: case 0x2A: case 0x3A: // ld a, [r16mem]
+    case 0x03: case 0x13: case 0x23: case 0x33: // inc r16
+    case 0x0B: case 0x1B: case 0x2B: case 0x3B: // dec r16
+    case 0x09: case 0x19: case 0x29: case 0x39: // add hl, r16
+    case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // inc r8
+    case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // dec r8
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // ld r8, imm8
+    case 0x2F: case 0x37: case 0x3F: // cpl, scf, ccf
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // jr (cond), imm8
+    case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // jp (cond), imm16
+    case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu a, imm8
+    case 0xF9: // ld sp, hl
+        return true;
+    case 0xE0: case 0xF0: // ldh, I/O registers always take the interpreter
+        return IsHighRAM(static_cast<Address>(0xFF00 + instruction.operands[0]));
+    case 0xEA: case 0xFA: // ld [imm16], a / ld a, [imm16]
+        return address < 0xFF00 || IsHighRAM(address);
+    default:
+        return false;
+    }
+}
+
+constexpr U8 Recompiler::FlagsUsed(const BlockCache::DecodedInstruction& instruction)
+{
+    if (!IsTranslated(instruction)) return ALL_FLAGS;
+
+    const U8 opcode = instruction.opcode;
+
+    // adc, sbc and ccf read C
+    if ((opcode >= 0x88 && opcode < 0x90) || (opcode >= 0x98 && opcode < 0xA0)) return CARRY;
+
+    switch (opcode)
+    {
+    case 0x02: case 0x12: case 0x22: case 0x32: case 0x36: case 0xE0: case 0xEA: // writes may leave the block
+    case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77:
+        return ALL_FLAGS;
+    case 0x20: case 0x28: case 0xC2: case 0xCA:
+        return ZERO;
+    case 0x30: case 0x38: case 0xD2: case 0xDA:
+    case 0xCE: case 0xDE: case 0x3F:
+        return CARRY;
+    default:
+        return 0;
+    }
+}
+
+constexpr U8 Recompiler::FlagsDefined(const BlockCache::DecodedInstruction& instruction)
+{
+    if (!IsTranslated(instruction)) return 0;
+
+    const U8 opcode = instruction.opcode;
+    if ((opcode >= 0x80 && opcode < 0xC0) || (opcode & 0xC7) == 0xC6) return ALL_FLAGS;
+    if (opcode < 0x40 && ((opcode & 0x07) == 0x04 || (opcode & 0x07) == 0x05)) return ZERO | SUBTRACT | HALF;
+
+    switch (opcode)
+    {
+    case 0x09: case 0x19: case 0x29: case 0x39: // add hl, r16
+    case 0x37: case 0x3F: // scf, ccf
+        return SUBTRACT | HALF | CARRY;
+    case 0x2F: // cpl
+        return SUBTRACT | HALF;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,48 @@
+#include "Scheduler.hpp"
+
+#include <utility>
+
+void Scheduler::Register(Event event, Callback callback)
+{
+    m_Events[static_cast<Size>(event)].callback = std::move(callback);
+}
+
+void Scheduler::Schedule(Event event, U64 timestamp)
+{
+    m_Events[static_cast<Size>(event)].deadline = timestamp;
+    UpdateNextDeadline();
+}
+
+void Scheduler::Cancel(Event event)
+{
+    m_Events[static_cast<Size>(event)].deadline = NEVER;
+    UpdateNextDeadline();
+}
+
+void Scheduler::Dispatch()
+{
+    // Run every due event in timestamp order; callbacks may schedule again, even in the past
+    while (m_NextDeadline <= m_Now)
+    {
+        Entry* earliest = &m_Events[0];
+        for (auto& entry : m_Events)
+        {
+            if (entry.deadline < earliest->deadline) earliest = &entry;
+        }
+
+        const U64 timestamp = earliest->deadline;
+        earliest->deadline = NEVER;
+        UpdateNextDeadline();
+
+        earliest->callback(timestamp);
+    }
+}
+
+void Scheduler::UpdateNextDeadline()
+{
+    m_NextDeadline = NEVER;
+    for (const auto& entry : m_Events)
+    {
+        if (entry.deadline < m_NextDeadline) m_NextDeadline = entry.deadline;
+    }
+}
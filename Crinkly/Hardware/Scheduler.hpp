@@ -0,0 +1,56 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <limits>
+
+#include "Utility/Types.hpp"
+
+// Timestamp-ordered event scheduler, owned by the console. Components schedule their next deadline
+// in absolute T-cycles; the CPU only advances the clock and calls back into the components once the
+// earliest deadline has passed, so the per-instruction cost does not depend on how many there are.
+class Scheduler
+{
+public:
+    enum class Event : U8
+    {
+        Timer,
+        PPU,
+        Serial,
+        DMA,
+        Count
+    };
+
+    // Receives the timestamp the event was scheduled for, which may be slightly in the past
+    using Callback = std::function<void(U64 timestamp)>;
+
+    static constexpr U64 NEVER = std::numeric_limits<U64>::max();
+
+public:
+    void Register(Event event, Callback callback);
+    void Schedule(Event event, U64 timestamp);
+    void Cancel(Event event);
+
+    U64 Now() const { return m_Now; }
+    U64 NextDeadline() const { return m_NextDeadline; }
+
+    void Advance(U32 cycles)
+    {
+        m_Now += cycles;
+        if (m_Now >= m_NextDeadline) Dispatch();
+    }
+
+private:
+    void Dispatch();
+    void UpdateNextDeadline();
+
+private:
+    struct Entry
+    {
+        U64 deadline = NEVER;
+        Callback callback;
+    };
+
+    std::array<Entry, static_cast<Size>(Event::Count)> m_Events;
+    U64 m_Now = 0;
+    U64 m_NextDeadline = NEVER;
+};
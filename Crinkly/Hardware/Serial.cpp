@@ -0,0 +1,27 @@
+#include "Serial.hpp"
+
+#include <print>
+
+Serial::Serial(Bus& bus, Scheduler& scheduler) : m_Bus(bus), m_Scheduler(scheduler)
+{
+    m_Scheduler.Register(Scheduler::Event::Serial, [this](U64 timestamp) { Complete(timestamp); });
+
+    m_Bus.OnWrite(0xFF02, [this](Byte value) { Control(value); });
+}
+
+void Serial::Control(U8 value)
+{
+    if ((value & 0x81) != 0x81) return;
+
+    std::print("{}", static_cast<char>(m_Bus.IO(0xFF01)));
+
+    m_Scheduler.Schedule(Scheduler::Event::Serial, m_Scheduler.Now() + TRANSFER_CYCLES);
+}
+
+void Serial::Complete(U64)
+{
+    // Nothing is connected, so the byte shifted in is all ones
+    m_Bus.IO(0xFF01) = 0xFF;
+    m_Bus.IO(0xFF02) &= 0x7F;
+    m_Bus.RequestInterrupt(0x08);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "Bus.hpp"
+#include "Scheduler.hpp"
+#include "Utility/Types.hpp"
+
+// Serial port without a link partner. Bytes sent with the internal clock are echoed to stdout,
+// which is how test ROMs report their results.
+class Serial
+{
+public:
+    // 8 bits at 8192 Hz
+    static constexpr U32 TRANSFER_CYCLES = 4096;
+
+public:
+    Serial(Bus& bus, Scheduler& scheduler);
+
+private:
+    // SC (0xFF02) writes
+    void Control(U8 value);
+    void Complete(U64 timestamp);
+
+private:
+    Bus& m_Bus;
+    Scheduler& m_Scheduler;
+};
@@ -0,0 +1,32 @@
+#include "TileCache.hpp"
+
+#include "PixelDecoder.hpp"
+
+void TileCache::Clear()
+{
+    m_Dirty.fill(true);
+    m_AnyDirty = true;
+}
+
+void TileCache::Update(std::span<const Byte> videoRAM)
+{
+    if (!m_AnyDirty) return;
+    m_AnyDirty = false;
+
+    // Uploads tend to cover consecutive tiles, which decode as one run
+    Size tile = 0;
+    while (tile < TILE_COUNT)
+    {
+        if (!m_Dirty[tile])
+        {
+            tile++;
+            continue;
+        }
+
+        Size end = tile;
+        while (end < TILE_COUNT && m_Dirty[end]) m_Dirty[end++] = false;
+
+        PixelDecoder::DecodeRows(videoRAM.data() + tile * TILE_BYTES, (end - tile) * 8, false, m_Tiles[tile].data());
+        tile = end;
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <span>
+
+#include "Utility/Types.hpp"
+
+// The 384 tiles of VRAM tile data (0x8000-0x97FF) pre-decoded from 2bpp bitplanes to one color
+// number (0-3) per pixel. The bus marks a tile dirty whenever one of its bytes is written, and only
+// dirty tiles are decoded again, so drawing a line is row lookups instead of bit twiddling.
+class TileCache
+{
+public:
+    static constexpr Size TILE_COUNT = 384;
+    static constexpr Size TILE_BYTES = 16;
+    static constexpr Address TILE_DATA_END = 0x9800;
+
+    // Row-major, 8 rows of 8 pixels with the leftmost first
+    using Tile = std::array<U8, 64>;
+
+public:
+    TileCache() { Clear(); }
+
+    // Called by the bus on every write to video memory; tile map writes are ignored
+    void Invalidate(Address address)
+    {
+        if (address >= TILE_DATA_END) return;
+        m_Dirty[(address - 0x8000) / TILE_BYTES] = true;
+        m_AnyDirty = true;
+    }
+
+    // Marks every tile dirty, for when video memory was replaced wholesale
+    void Clear();
+
+    // Decodes the dirty tiles from `videoRAM`
+    void Update(std::span<const Byte> videoRAM);
+
+    // `tile` numbers the 384 tiles from 0x8000; valid as of the last Update
+    const U8* Row(Size tile, U8 row) const { return m_Tiles[tile].data() + row * 8; }
+
+private:
+    std::array<Tile, TILE_COUNT> m_Tiles {};
+    std::array<bool, TILE_COUNT> m_Dirty {};
+    bool m_AnyDirty = false;
+};
+
+// Runs of consecutive tiles are decoded in one go
+static_assert(sizeof(std::array<TileCache::Tile, 2>) == 2 * sizeof(TileCache::Tile));
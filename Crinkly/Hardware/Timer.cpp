@@ -0,0 +1,49 @@
+#include "Timer.hpp"
+
+Timer::Timer(Bus& bus, Scheduler& scheduler) : m_Bus(bus), m_Scheduler(scheduler)
+{
+    m_Period = k_Periods[0];
+
+    m_Scheduler.Register(Scheduler::Event::Timer, [this](U64 timestamp) { Tick(timestamp); });
+
+    m_Bus.OnRead(0xFF04, [this] { return static_cast<Byte>((m_Scheduler.Now() - m_DividerBase) >> 8); });
+    m_Bus.OnWrite(0xFF04, [this](Byte) { ResetDivider(); });
+    m_Bus.OnWrite(0xFF07, [this](Byte value) { Control(value); });
+}
+
+void Timer::Control(U8 value)
+{
+    m_Running = value & 0x04;
+    m_Period = k_Periods[value & 0x03];
+
+    if (m_Running) ScheduleTick();
+    else m_Scheduler.Cancel(Scheduler::Event::Timer);
+}
+
+void Timer::ResetDivider()
+{
+    // TIMA counts on the same divider, so its next tick moves as well
+    m_DividerBase = m_Scheduler.Now();
+    if (m_Running) ScheduleTick();
+}
+
+void Timer::ScheduleTick()
+{
+    // TIMA ticks on multiples of the period, counted from the last divider reset
+    const U64 elapsed = m_Scheduler.Now() - m_DividerBase;
+    m_Scheduler.Schedule(Scheduler::Event::Timer, m_DividerBase + (elapsed / m_Period + 1) * m_Period);
+}
+
+void Timer::Tick(U64 timestamp)
+{
+    U8 TIMA = m_Bus.IO(0xFF05) + 1;
+    if (TIMA == 0x00)
+    {
+        TIMA = m_Bus.IO(0xFF06);
+        m_Bus.RequestInterrupt(0x04);
+    }
+
+    m_Bus.IO(0xFF05) = TIMA;
+
+    m_Scheduler.Schedule(Scheduler::Event::Timer, timestamp + m_Period);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "Bus.hpp"
+#include "Scheduler.hpp"
+#include "Utility/Types.hpp"
+
+// DIV/TIMA/TMA/TAC. TIMA only ever changes on a scheduled tick and DIV is derived from the clock
+// when it is read, so nothing is polled per instruction.
+class Timer
+{
+public:
+    Timer(Bus& bus, Scheduler& scheduler);
+
+private:
+    // TAC (0xFF07) and DIV (0xFF04) writes
+    void Control(U8 value);
+    void ResetDivider();
+
+    void ScheduleTick();
+    void Tick(U64 timestamp);
+
+private:
+    // T-cycles per TIMA increment for each TAC clock select
+    static constexpr U32 k_Periods[] = { 1024, 16, 64, 256 };
+
+    Bus& m_Bus;
+    Scheduler& m_Scheduler;
+    U32 m_Period;
+    bool m_Running = false;
+
+    // When the divider last read 0; DIV is its upper byte and TIMA ticks on its period multiples
+    U64 m_DividerBase = 0;
+};
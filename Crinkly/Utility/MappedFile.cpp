@@ -0,0 +1,141 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+
+#ifdef _WIN32
+    const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.HighPart != 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    if (length.LowPart > 0)
+    {
+        // The view keeps the mapping, and the mapping the file, alive after the handles are closed
+        const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr)
+        {
+            m_Data = static_cast<Byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+
+    if (length.LowPart > 0 && m_Data == nullptr) return false;
+    m_Length = length.LowPart;
+#else
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size > 0xFFFFFFFF)
+    {
+        close(file);
+        return false;
+    }
+
+    if (status.st_size > 0)
+    {
+        // The mapping keeps the file alive after the descriptor is closed
+        void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED) m_Data = static_cast<Byte*>(data);
+    }
+    close(file);
+
+    if (status.st_size > 0 && m_Data == nullptr) return false;
+    m_Length = static_cast<Size>(status.st_size);
+#endif
+
+    return true;
+}
+
+bool MappedFile::OpenWritable(const std::string& path, Size length)
+{
+    Close();
+    if (length == 0) return false;
+
+#ifdef _WIN32
+    const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    // A mapping larger than the file extends it with zeros
+    const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, length, nullptr);
+    if (mapping != nullptr)
+    {
+        m_Data = static_cast<Byte*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, length));
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    const int file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (file < 0) return false;
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || (status.st_size < length && ftruncate(file, length) != 0))
+    {
+        close(file);
+        return false;
+    }
+
+    void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (data != MAP_FAILED) m_Data = static_cast<Byte*>(data);
+    close(file);
+#endif
+
+    if (m_Data == nullptr) return false;
+    m_Length = length;
+    m_Writable = true;
+    return true;
+}
+
+void MappedFile::Flush()
+{
+    if (!m_Writable || m_Data == nullptr) return;
+
+#ifdef _WIN32
+    FlushViewOfFile(m_Data, 0);
+#else
+    msync(m_Data, m_Length, MS_ASYNC);
+#endif
+}
+
+void MappedFile::Close()
+{
+    if (m_Data != nullptr)
+    {
+        Flush();
+#ifdef _WIN32
+        UnmapViewOfFile(m_Data);
+#else
+        munmap(m_Data, m_Length);
+#endif
+    }
+
+    m_Data = nullptr;
+    m_Length = 0;
+    m_Writable = false;
+}
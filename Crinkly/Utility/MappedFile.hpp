@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+
+#include "Types.hpp"
+
+// A whole file mapped into memory. Pages are faulted in by the OS as they are touched, so opening
+// even a large file costs no reads up front. A writable mapping is shared with the file: the OS
+// tracks which pages were written and writes them back on its own.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Read-only. Returns false when the file cannot be opened or mapped; an empty file opens with no data
+    bool Open(const std::string& path);
+
+    // Read-write over the first `length` bytes, creating the file or zero-extending it as needed;
+    // anything past `length` is kept but not mapped
+    bool OpenWritable(const std::string& path, Size length);
+
+    // Starts writing dirty pages back without waiting for the disk
+    void Flush();
+    void Close();
+
+    const Byte* Data() const { return m_Data; }
+    Byte* WritableData() { return m_Writable ? m_Data : nullptr; }
+    Size Length() const { return m_Length; }
+
+private:
+    Byte* m_Data = nullptr;
+    Size m_Length = 0;
+    bool m_Writable = false;
+};
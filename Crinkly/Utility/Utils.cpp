@@ -4,7 +4,7 @@
 
 void IncorrectUsage(const std::string& exeName)
 {
-    std::cout << "Incorrect Usage.\nUsage: " << exeName << " <filename>\n";
+    std::cout << "Incorrect Usage.\nUsage: " << exeName << " <filename> [-noidleskip]\n       " << exeName << " -benchpixels\n";
 
     system("pause");
     exit(127);